@@ -0,0 +1,172 @@
+// Multi-asset databases: every column of a "date,btc,eth,sol" file must
+// answer exactly like a single-column file holding only that column,
+// whether the column is chosen with setAsset (--asset) or by the asset
+// field of the query line. Unknown assets, empty asset fields and rows
+// with a missing or extra column are rejected.
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include "BitcoinExchange.hpp"
+#include "TestSupport.hpp"
+
+static long g_queries = 0;
+
+static const char* const ASSETS[] = { "btc", "eth", "sol" };
+static const size_t ASSET_COUNT = 3;
+
+struct Row {
+    char date[11];
+    char rates[ASSET_COUNT][16];
+};
+
+static bool writeFile(const std::string& path, const std::string& text) {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+    const bool ok = std::fwrite(text.data(), 1, text.size(), f) == text.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+// The whole table, or only one column of it under the old header
+static std::string csvText(const std::vector<Row>& rows, long only) {
+    std::string text = "date";
+    for (size_t c = 0; c < ASSET_COUNT; ++c) {
+        if (only < 0 || static_cast<size_t>(only) == c)
+            text += std::string(",") + (only < 0 ? ASSETS[c] : "exchange_rate");
+    }
+    text += "\n";
+    for (size_t i = 0; i < rows.size(); ++i) {
+        text += rows[i].date;
+        for (size_t c = 0; c < ASSET_COUNT; ++c) {
+            if (only < 0 || static_cast<size_t>(only) == c)
+                text += std::string(",") + rows[i].rates[c];
+        }
+        text += "\n";
+    }
+    return text;
+}
+
+static std::string reply(const BitcoinExchange& exchange, const std::string& line) {
+    const LineSlice slice = { line.data(), line.size() };
+    std::vector<char> response;
+    exchange.answerQuery(slice, '|', response);
+    return std::string(response.begin(), response.end());
+}
+
+static void expect(const std::string& what, const std::string& got, const std::string& want) {
+    ++g_queries;
+    if (got != want)
+        fail(what + ": got \"" + got + "\", want \"" + want + "\"");
+}
+
+static bool loads(const std::string& path) {
+    try {
+        BitcoinExchange exchange(path, ',');
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0xcbbb9d5du) << 32) | 0xc1059ed8u);
+    char dir[] = "/tmp/asset_test.XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::cerr << "asset_test: no temporary directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string multi = std::string(dir) + "/multi.csv";
+    std::string single[ASSET_COUNT];
+
+    // Rows on random days of 2010 and 2011, so queries also fall in gaps
+    std::vector<Row> rows;
+    for (unsigned day = 0; day < 2 * 12 * 28; ++day) {
+        if (nextRandom() % 3)
+            continue;
+        Row row;
+        std::sprintf(row.date, "%04u-%02u-%02u", 2010 + day / (12 * 28), 1 + day / 28 % 12, 1 + day % 28);
+        for (size_t c = 0; c < ASSET_COUNT; ++c)
+            std::sprintf(row.rates[c], "%u.%02u", unsigned(nextRandom() % 100000), unsigned(nextRandom() % 100));
+        rows.push_back(row);
+    }
+    writeFile(multi, csvText(rows, -1));
+    for (size_t c = 0; c < ASSET_COUNT; ++c) {
+        single[c] = std::string(dir) + "/" + ASSETS[c] + ".csv";
+        writeFile(single[c], csvText(rows, static_cast<long>(c)));
+    }
+
+    BitcoinExchange all(multi, ',');
+    if (all.assetCount() != ASSET_COUNT)
+        fail("multi-asset database: wrong number of assets");
+    for (size_t c = 0; c < all.assetCount() && c < ASSET_COUNT; ++c) {
+        if (all.assetName(c) != ASSETS[c])
+            fail("multi-asset database: asset " + all.assetName(c) + " out of place");
+    }
+    for (size_t c = 0; c < ASSET_COUNT; ++c) {
+        const BitcoinExchange reference(single[c], ',');
+        BitcoinExchange selected(all);
+        selected.setAsset(ASSETS[c]);
+        // Another asset selected: the line's own asset field wins
+        BitcoinExchange other(all);
+        other.setAsset(ASSETS[(c + 1) % ASSET_COUNT]);
+        for (int i = 0; i < 3000; ++i) {
+            char line[64];
+            std::sprintf(line, "%04u-%02u-%02u | %u.%u", unsigned(2009 + nextRandom() % 4), unsigned(1 + nextRandom() % 12),
+                unsigned(1 + nextRandom() % 28), unsigned(nextRandom() % 1100), unsigned(nextRandom() % 10));
+            const std::string want = reply(reference, line);
+            const std::string field = std::string(line) + " | " + ASSETS[c];
+            expect(std::string("--asset ") + ASSETS[c], reply(selected, line), want);
+            expect("asset field", reply(all, field), want);
+            expect("asset field over --asset", reply(other, field), want);
+        }
+    }
+
+    // Unknown assets: setAsset throws and leaves the selection as it was,
+    // a query naming one, or an empty asset field, is bad input
+    BitcoinExchange selected(all);
+    selected.setAsset("eth");
+    try {
+        selected.setAsset("doge");
+        fail("setAsset accepted an unknown asset");
+    } catch (const std::runtime_error&) {
+    }
+    const BitcoinExchange eth(single[1], ',');
+    expect("after a failed setAsset", reply(selected, "2011-01-03 | 2"), reply(eth, "2011-01-03 | 2"));
+    expect("unknown asset field", reply(all, "2011-01-03 | 2 | doge"), "Error: bad input => 2011-01-03 | 2 | doge\n");
+    expect("empty asset field", reply(all, "2011-01-03 | 2 |"), "Error: bad input => 2011-01-03 | 2 |\n");
+    expect("asset name prefix", reply(all, "2011-01-03 | 2 | et"), "Error: bad input => 2011-01-03 | 2 | et\n");
+
+    // A row with a column missing, or one too many, does not load
+    const std::string bad = std::string(dir) + "/bad.csv";
+    std::vector<Row> broken(rows.begin(), rows.begin() + 10);
+    std::string text = csvText(broken, -1);
+    writeFile(bad, text);
+    if (!loads(bad))
+        fail("a well-formed multi-asset database did not load");
+    const size_t lastComma = text.rfind(',', text.size() - 1);
+    const size_t lineEnd = text.find('\n', lastComma);
+    writeFile(bad, text.substr(0, lastComma) + text.substr(lineEnd));
+    if (loads(bad))
+        fail("a row with a missing column loaded");
+    writeFile(bad, text.substr(0, lineEnd) + ",1.5" + text.substr(lineEnd));
+    if (loads(bad))
+        fail("a row with an extra column loaded");
+    const size_t headerEnd = text.find('\n');
+    writeFile(bad, text.substr(0, headerEnd) + ",xrp" + text.substr(headerEnd));
+    if (loads(bad))
+        fail("a header naming more assets than the rows have loaded");
+
+    unlink(bad.c_str());
+    unlink(multi.c_str());
+    for (size_t c = 0; c < ASSET_COUNT; ++c)
+        unlink(single[c].c_str());
+    rmdir(dir);
+
+    std::cout << "asset_test: " << g_queries << " queries, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
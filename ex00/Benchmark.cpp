@@ -0,0 +1,174 @@
+// Load/throughput benchmark for btc. Prints one JSON object per run so
+// results can be appended to a file and compared across versions.
+//
+//   btc_bench <database.csv> <input_file> [-j threads] [--dense | --sorted] [--fixed] [--label text]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "BitcoinExchange.hpp"
+#include "JsonText.hpp"
+#include "LineParser.hpp"
+#include "LineReader.hpp"
+#include "MappedFile.hpp"
+
+// Lookups are timed in batches; a single clock read costs as much as a lookup
+static const size_t LOOKUP_BATCH = 64;
+static const size_t LOOKUP_ROUNDS = 20000;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long peakRssKb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// Every valid date in the input, in file order, to replay against the table
+static std::vector<int> collectDays(const std::string& path, size_t& lines) {
+    std::vector<int> days;
+    MappedFile file(path);
+    LineReader reader(file.data(), file.size());
+    LineSlice line;
+    lines = 0;
+    reader.next(line);
+    while (reader.next(line)) {
+        ++lines;
+        int day;
+        if (line.len >= 10 && parseDate(line.ptr, 10, day))
+            days.push_back(day);
+    }
+    return days;
+}
+
+// Output goes to /dev/null so the run measures btc, not the terminal
+static double timeProcessing(BitcoinExchange& exchange, const std::string& input) {
+    std::cout.flush();
+    const int savedOut = dup(STDOUT_FILENO);
+    const int savedErr = dup(STDERR_FILENO);
+    const int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(null);
+    const double start = now();
+    exchange.processFile(&input, '|');
+    const double elapsed = now() - start;
+    dup2(savedOut, STDOUT_FILENO);
+    dup2(savedErr, STDERR_FILENO);
+    close(savedOut);
+    close(savedErr);
+    return elapsed;
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+static int usage() {
+    std::cerr << "Usage: ./btc_bench <database.csv> <input_file> [-j threads] [--dense | --sorted] [--fixed] [--label text]" << std::endl;
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3)
+        return usage();
+    const std::string database = argv[1];
+    const std::string input = argv[2];
+    int threads = 1;
+    bool dense = false;
+    bool sorted = false;
+    bool fixedPoint = false;
+    std::string label;
+    for (int i = 3; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            char* end;
+            const long n = std::strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n < 1 || n > 256)
+                return usage();
+            threads = static_cast<int>(n);
+        } else if (std::strcmp(argv[i], "--dense") == 0)
+            dense = true;
+        else if (std::strcmp(argv[i], "--sorted") == 0)
+            sorted = true;
+        else if (std::strcmp(argv[i], "--fixed") == 0)
+            fixedPoint = true;
+        else if (std::strcmp(argv[i], "--label") == 0 && i + 1 < argc)
+            label = argv[++i];
+        else
+            return usage();
+    }
+    if (dense && sorted)
+        return usage();
+    try {
+        double start = now();
+        BitcoinExchange exchange(database, ',');
+        const double loadSeconds = now() - start;
+        start = now();
+        if (dense)
+            exchange.setDenseLookup(true);
+        if (fixedPoint)
+            exchange.setFixedPoint(true);
+        const double indexSeconds = now() - start;
+        exchange.setThreadCount(threads);
+        exchange.setSortedLookup(sorted);
+
+        const double processSeconds = timeProcessing(exchange, input);
+
+        size_t lines;
+        std::vector<int> days = collectDays(input, lines);
+        std::vector<double> latencies;
+        double checksum = 0;
+        if (!days.empty()) {
+            latencies.reserve(LOOKUP_ROUNDS);
+            size_t next = 0;
+            for (size_t round = 0; round < LOOKUP_ROUNDS; ++round) {
+                const double batchStart = now();
+                for (size_t k = 0; k < LOOKUP_BATCH; ++k) {
+                    double rate;
+                    if (exchange.rateOn(days[next], rate))
+                        checksum += rate;
+                    if (++next == days.size())
+                        next = 0;
+                }
+                latencies.push_back((now() - batchStart) * 1e9 / LOOKUP_BATCH);
+            }
+            std::sort(latencies.begin(), latencies.end());
+        }
+
+        const std::string names = "{\"label\":" + jsonString(label) + ",\"database\":" + jsonString(database)
+            + ",\"input\":" + jsonString(input) + ",";
+        std::printf("%s\"threads\":%d,\"dense\":%s,\"sorted\":%s,\"fixed\":%s,", names.c_str(), threads,
+            dense ? "true" : "false", sorted ? "true" : "false", fixedPoint ? "true" : "false");
+        std::printf("\"db_rows\":%lu,\"load_ms\":%.3f,\"index_ms\":%.3f,",
+            static_cast<unsigned long>(exchange.size()), loadSeconds * 1e3, indexSeconds * 1e3);
+        std::printf("\"lines\":%lu,\"process_ms\":%.3f,\"lines_per_sec\":%.0f,",
+            static_cast<unsigned long>(lines), processSeconds * 1e3, processSeconds > 0 ? lines / processSeconds : 0.0);
+        std::printf("\"lookup_ns\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},",
+            percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99),
+            percentile(latencies, 0.999), latencies.empty() ? 0.0 : latencies.back());
+        std::printf("\"peak_rss_kb\":%ld,\"checksum\":%g}\n", peakRssKb(), checksum);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
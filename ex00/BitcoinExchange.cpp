@@ -1,31 +1,214 @@
-#include <fstream>
 #include <sstream>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <cstdio>
 #include <stdexcept>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <vector>
 #include "BitcoinExchange.hpp"
+#include "MappedFile.hpp"
+#include "LineParser.hpp"
+#include "OutputBuffer.hpp"
+#include "Hash.hpp"
+#include "JsonText.hpp"
 
-BitcoinExchange::BitcoinExchange() : _filename(""), _delimiter(',') {}
+static uint64_t monotonicNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+BitcoinExchange::QueryStats::QueryStats()
+    : lines(0), exact(0), previous(0), parseNs(0), lookupNs(0), outputNs(0) {
+    std::memset(outcomes, 0, sizeof(outcomes));
+    std::memset(latency, 0, sizeof(latency));
+}
+
+void BitcoinExchange::QueryStats::merge(const QueryStats& other) {
+    lines += other.lines;
+    for (int kind = 0; kind < QUERY_ERROR_KINDS; ++kind)
+        outcomes[kind] += other.outcomes[kind];
+    exact += other.exact;
+    previous += other.previous;
+    parseNs += other.parseNs;
+    lookupNs += other.lookupNs;
+    outputNs += other.outputNs;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i)
+        latency[i] += other.latency[i];
+}
+
+BitcoinExchange::BitcoinExchange() : _db(new RateTable), _filename(""), _delimiter(','), _threads(1), _dense(false), _sorted(false), _summary(false), _ranges(false), _stats(false), _fixedPoint(false), _loadNs(0), _indexNs(0), _column(0) {
+    std::memset(&_load, 0, sizeof(_load));
+}
 
 BitcoinExchange::BitcoinExchange(const std::string& filename, char delimiter)
-    : _filename(filename), _delimiter(delimiter) {
+    : _db(new RateTable), _filename(filename), _delimiter(delimiter), _threads(1), _dense(false), _sorted(false), _summary(false), _ranges(false), _stats(false), _fixedPoint(false), _loadNs(0), _indexNs(0), _column(0) {
+    std::memset(&_load, 0, sizeof(_load));
+    const uint64_t start = monotonicNanos();
     processFile();
+    _loadNs = monotonicNanos() - start;
+}
+
+// Uses the binary snapshot when it is valid and was compiled from the
+// current filename, and parses the CSV otherwise
+BitcoinExchange::BitcoinExchange(const std::string& filename, char delimiter, const std::string& snapshot)
+    : _db(new RateTable), _filename(filename), _delimiter(delimiter), _threads(1), _dense(false), _sorted(false), _summary(false), _ranges(false), _stats(false), _fixedPoint(false), _loadNs(0), _indexNs(0), _column(0) {
+    std::memset(&_load, 0, sizeof(_load));
+    const uint64_t start = monotonicNanos();
+    SharedPtr<RateTable> next(new RateTable);
+    if (!next->loadSnapshot(snapshot, _filename))
+        processFile();
+    else {
+        _db.swap(next);
+        // The snapshot matches the whole file as it is now; remember where its
+        // last complete line ends (line numbers are counted if ever needed)
+        MappedFile file(_filename);
+        size_t offset = file.size();
+        while (offset > 0 && file.data()[offset - 1] != '\n')
+            --offset;
+        recordLoadState(file, offset, 0);
+    }
+    _loadNs = monotonicNanos() - start;
 }
 
 BitcoinExchange::BitcoinExchange(const BitcoinExchange& other)
-    : _db(other._db), _filename(other._filename), _delimiter(other._delimiter) {}
+    : _db(other._db), _filename(other._filename), _delimiter(other._delimiter), _threads(other._threads), _dense(other._dense), _sorted(other._sorted), _summary(other._summary), _ranges(other._ranges), _stats(other._stats), _fixedPoint(other._fixedPoint), _loadNs(other._loadNs), _indexNs(other._indexNs), _asset(other._asset), _column(other._column), _load(other._load) {}
 
 BitcoinExchange& BitcoinExchange::operator=(const BitcoinExchange& other) {
     if (this != &other) {
         _db = other._db;
         _filename = other._filename;
         _delimiter = other._delimiter;
+        _threads = other._threads;
+        _dense = other._dense;
+        _sorted = other._sorted;
+        _summary = other._summary;
+        _ranges = other._ranges;
+        _stats = other._stats;
+        _fixedPoint = other._fixedPoint;
+        _loadNs = other._loadNs;
+        _indexNs = other._indexNs;
+        _asset = other._asset;
+        _column = other._column;
+        _load = other._load;
     }
     return *this;
 }
 
 BitcoinExchange::~BitcoinExchange() {}
 
+// A copy of the table to make the next version in. A published table is
+// never changed, even with no other owner: the copy replaces _db only once
+// it is complete, so readers never see one half-built, and a throw on the
+// way leaves the current one in place.
+SharedPtr<RateTable> BitcoinExchange::draft() const {
+    return SharedPtr<RateTable>(new RateTable(*_db));
+}
+
+// Number of worker threads used for input files (1 = no threads)
+void BitcoinExchange::setThreadCount(int threads) {
+    _threads = threads < 1 ? 1 : threads;
+}
+
+// Trades ~130 KiB for O(1) lookups: findRate indexes a per-day array
+// covering every date parseDate accepts instead of searching the table
+void BitcoinExchange::setDenseLookup(bool enabled) {
+    const uint64_t start = monotonicNanos();
+    _dense = enabled;
+    if (_dense != _db->hasCalendar()) {
+        SharedPtr<RateTable> next = draft();
+        if (_dense)
+            next->buildCalendar(RateTable::dayNumber(MAX_YEAR, 12, 31));
+        else
+            next->clearCalendar();
+        _db.swap(next);
+    }
+    _indexNs += monotonicNanos() - start;
+}
+
+// For inputs that are mostly in date order: each lookup continues from the
+// previous one (a merge join against the table) and the number of lookups
+// that could do so is reported at the end
+void BitcoinExchange::setSortedLookup(bool enabled) {
+    _sorted = enabled;
+}
+
+// Instead of one message per rejected input line, count them by kind and
+// print the totals at the end
+void BitcoinExchange::setErrorSummary(bool enabled) {
+    _summary = enabled;
+}
+
+// Selects the database column queries are answered from, by its name in
+// the header line; an empty name selects the first column
+void BitcoinExchange::setAsset(const std::string& name) {
+    long column = name.empty() ? 0 : _db->findColumn(name);
+    if (column < 0)
+        throw std::runtime_error(makeErrorString(true, 0, "unknown asset " + name + "."));
+    _asset = name;
+    _column = static_cast<size_t>(column);
+}
+
+// Input lines become "from..to | value" range queries, answered with the
+// sum, average, min and max of value * rate and of the rate over every
+// day of the range. Builds the O(1) range index; off drops it.
+void BitcoinExchange::setRangeQueries(bool enabled) {
+    const uint64_t start = monotonicNanos();
+    _ranges = enabled;
+    if (_ranges != _db->hasRanges()) {
+        SharedPtr<RateTable> next = draft();
+        if (_ranges)
+            next->buildRanges();
+        else
+            next->clearRanges();
+        _db.swap(next);
+    }
+    _indexNs += monotonicNanos() - start;
+}
+
+// processFile reports where an input run spent its time, line counts by
+// outcome and a lookup latency histogram, as one JSON object on stderr.
+// Off, the per-line path is the same as without it.
+void BitcoinExchange::setStats(bool enabled) {
+    _stats = enabled;
+}
+
+// Query values are parsed into Fixed and results computed and printed
+// from exact integer products (see FixedPoint.hpp): the same digits on
+// every machine, where the default mode prints "%g" of a double product.
+// Builds the table's Fixed rates; off drops them.
+void BitcoinExchange::setFixedPoint(bool enabled) {
+    const uint64_t start = monotonicNanos();
+    _fixedPoint = enabled;
+    if (_fixedPoint != _db->hasFixed()) {
+        SharedPtr<RateTable> next = draft();
+        if (_fixedPoint)
+            next->buildFixed();
+        else
+            next->clearFixed();
+        _db.swap(next);
+    }
+    _indexNs += monotonicNanos() - start;
+}
+
+size_t BitcoinExchange::assetCount() const {
+    return _db->columns();
+}
+
+const std::string& BitcoinExchange::assetName(size_t index) const {
+    return _db->columnName(index);
+}
+
+void BitcoinExchange::saveSnapshot(const std::string& snapshot) const {
+    if (!_db->writeSnapshot(snapshot, _filename))
+        throw std::runtime_error(makeErrorString(true, 0, "could not write snapshot " + snapshot + "."));
+}
+
 bool BitcoinExchange::printError(const std::string* p_filename, const int lineNumber, const std::string& msg) const {
     if (!p_filename) {
         std::cerr << _filename << ":" << lineNumber << ": ";
@@ -43,173 +226,903 @@ std::string BitcoinExchange::makeErrorString(const bool isInputFile, const int l
     return oss.str();
 }
 
-std::pair<std::string, double> BitcoinExchange::processLine(const bool isInputFile, const int lineNumber, const std::string& line, const char delim) const {
-    std::istringstream iss(line);
-    std::string date, valueStr;
-    if (!(getline(iss, date, delim) && getline(iss, valueStr)))
-        throw std::runtime_error(makeErrorString(isInputFile, lineNumber, "bad input => " + line));
-    // Trim whitespace
-    date.erase(0, date.find_first_not_of(" \t"));
-    date.erase(date.find_last_not_of(" \t") + 1);
-    valueStr.erase(0, valueStr.find_first_not_of(" \t"));
-    valueStr.erase(valueStr.find_last_not_of(" \t") + 1);
-    // Date format check
-    if (!isValidDate(date))
-        throw std::runtime_error(makeErrorString(isInputFile, lineNumber, "bad input => " + line));
-    // Value format and range check
-    if (!isValidValue(valueStr))
-        throw std::runtime_error(makeErrorString(isInputFile, lineNumber, "bad input => " + line));
-    double value = std::strtod(valueStr.c_str(), NULL);
-    return std::make_pair(date, value);
+// Strip spaces and tabs from both ends of [begin, end)
+static void trim(const char*& begin, const char*& end) {
+    while (begin < end && (*begin == ' ' || *begin == '\t'))
+        ++begin;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+}
+
+// Splits "date <delim> value" into its two trimmed fields; the value runs
+// to the end of the line
+static bool splitFields(const LineSlice& line, const char delim, LineSlice& date, LineSlice& value) {
+    const char* sep = static_cast<const char*>(std::memchr(line.ptr, delim, line.len));
+    if (!sep)
+        return false;
+    const char* dateBegin = line.ptr;
+    const char* dateEnd = sep;
+    const char* valueBegin = sep + 1;
+    const char* valueEnd = line.ptr + line.len;
+    trim(dateBegin, dateEnd);
+    trim(valueBegin, valueEnd);
+    date.ptr = dateBegin;
+    date.len = static_cast<size_t>(dateEnd - dateBegin);
+    value.ptr = valueBegin;
+    value.len = static_cast<size_t>(valueEnd - valueBegin);
+    return true;
+}
+
+// Cuts an "<delim> asset" field off the end of the value field; false if
+// the field is there but empty
+static inline bool cutAsset(const char* begin, const char*& end, const char delim, LineSlice& asset) {
+    const char* sep = static_cast<const char*>(std::memchr(begin, delim, static_cast<size_t>(end - begin)));
+    if (!sep) {
+        asset.ptr = end;
+        asset.len = 0;
+        return true;
+    }
+    const char* assetBegin = sep + 1;
+    const char* assetEnd = end;
+    trim(assetBegin, assetEnd);
+    asset.ptr = assetBegin;
+    asset.len = static_cast<size_t>(assetEnd - assetBegin);
+    end = sep;
+    trim(begin, end);
+    return asset.len != 0;
+}
+
+// The value field as a double, or as Fixed into parsed.amount
+static inline bool convertValue(const char* begin, const char* end, bool fixedPoint, ParsedLine& parsed) {
+    const size_t len = static_cast<size_t>(end - begin);
+    return fixedPoint ? parseFixed(begin, len, parsed.amount, &parsed.dropped) : parseValue(begin, len, parsed.value);
+}
+
+// Splits "date <delim> value [<delim> asset]" and converts the date and
+// value; false if the line is malformed in any way. The asset is left
+// as text in parsed.asset.
+static bool splitLine(const LineSlice& line, const char delim, bool fixedPoint, ParsedLine& parsed) {
+    // Usual shape: fixed date prefix; any other line takes the general path
+    const PrefixScan scan = scanDatePrefix(line.ptr, line.len, delim, parsed.day);
+    if (scan != PREFIX_OTHER) {
+        const char* valueBegin = line.ptr + DATE_PREFIX_LEN;
+        const char* valueEnd = line.ptr + line.len;
+        trim(valueBegin, valueEnd);
+        parsed.date.ptr = line.ptr;
+        parsed.date.len = 10;
+        return scan == PREFIX_DATE && cutAsset(valueBegin, valueEnd, delim, parsed.asset)
+            && convertValue(valueBegin, valueEnd, fixedPoint, parsed);
+    }
+    LineSlice value;
+    if (!splitFields(line, delim, parsed.date, value))
+        return false;
+    const char* valueEnd = value.ptr + value.len;
+    if (!cutAsset(value.ptr, valueEnd, delim, parsed.asset))
+        return false;
+    // Date format check and value format/range check, converting as we go
+    return parseDate(parsed.date.ptr, parsed.date.len, parsed.day)
+        && convertValue(value.ptr, valueEnd, fixedPoint, parsed);
+}
+
+// "date,<asset>,<asset>..." names the database columns. A header without
+// asset names keeps the single unnamed column of the original format.
+void BitcoinExchange::readHeader(const LineSlice& line, RateTable& db) const {
+    std::vector<std::string> names;
+    const char* end = line.ptr + line.len;
+    const char* field = static_cast<const char*>(std::memchr(line.ptr, _delimiter, line.len));
+    while (field) {
+        const char* begin = field + 1;
+        field = static_cast<const char*>(std::memchr(begin, _delimiter, static_cast<size_t>(end - begin)));
+        const char* nameEnd = field ? field : end;
+        trim(begin, nameEnd);
+        names.push_back(std::string(begin, nameEnd));
+    }
+    db.setColumns(names);
+}
+
+// Parses one "date,rate[,rate...]" database row with a rate for every
+// one of columns into rates and returns its day number
+int BitcoinExchange::processRow(const int lineNumber, const LineSlice& line, const size_t columns, double* rates) const {
+    const char* end = line.ptr + line.len;
+    const char* sep = static_cast<const char*>(std::memchr(line.ptr, _delimiter, line.len));
+    const char* dateBegin = line.ptr;
+    const char* dateEnd = sep;
+    int day = 0;
+    bool ok = sep != NULL;
+    if (ok) {
+        trim(dateBegin, dateEnd);
+        ok = parseDate(dateBegin, static_cast<size_t>(dateEnd - dateBegin), day);
+    }
+    // The last column takes the rest of the line, so extra fields fail to parse
+    for (size_t c = 0; ok && c < columns; ++c) {
+        const char* begin = sep + 1;
+        sep = c + 1 < columns ? static_cast<const char*>(std::memchr(begin, _delimiter, static_cast<size_t>(end - begin))) : end;
+        if (!sep) {
+            ok = false;
+            break;
+        }
+        const char* cellEnd = sep;
+        trim(begin, cellEnd);
+        ok = parseValue(begin, static_cast<size_t>(cellEnd - begin), rates[c]);
+    }
+    if (!ok)
+        throw std::runtime_error(makeErrorString(false, lineNumber, "bad input => " + std::string(line.ptr, line.len)));
+    for (size_t c = 0; c < columns; ++c) {
+        if (rates[c] < 0)
+            throw std::runtime_error(makeErrorString(false, lineNumber, "not a positive number."));
+    }
+    return day;
+}
+
+namespace {
+    const size_t RESULT_TAIL_MAX = DOUBLE_TEXT_MAX * 2 + 8;
+
+    // Wall-clock phases of an input run, for the stats report
+    enum { PHASE_OPEN, PHASE_QUERIES, PHASE_FLUSH, PHASE_TOTAL, PHASES };
+
+    struct ErrorText {
+        const char* text;
+        size_t len;
+    };
+
+    // Message per BitcoinExchange::QueryError; bad input is followed by the line
+    const ErrorText ERROR_TEXT[] = {
+        { "", 0 },
+        { "Error: bad input => ", 20 },
+        { "Error: not a positive number.", 29 },
+        { "Error: too large a number.", 26 },
+        { "Error: No lower date found in DB", 32 }
+    };
+
+    // Category names for the error summary
+    const char* const ERROR_KIND[] = {
+        "", "bad input", "not a positive number", "too large a number", "no earlier date"
+    };
+
+    // " => <value> = <value * rate>\n", the part of a result line after the date
+    size_t formatResultTail(const ParsedLine& data, double rate, char* buf) {
+        size_t n = 0;
+        std::memcpy(buf, " => ", 4);
+        n += 4;
+        n += formatDouble(data.value, buf + n);
+        std::memcpy(buf + n, " = ", 3);
+        n += 3;
+        n += formatDouble(data.value * rate, buf + n);
+        buf[n++] = '\n';
+        return n;
+    }
+
+    const size_t FIXED_TAIL_MAX = FIXED_TEXT_MAX * 2 + 8;
+
+    // The same in fixed-point mode, with the exact product
+    size_t formatFixedTail(const ParsedLine& data, Fixed product, char* buf) {
+        size_t n = 0;
+        std::memcpy(buf, " => ", 4);
+        n += 4;
+        n += formatFixed(data.amount, buf + n);
+        std::memcpy(buf + n, " = ", 3);
+        n += 3;
+        n += formatFixed(product, buf + n);
+        buf[n++] = '\n';
+        return n;
+    }
+
+    const size_t RANGE_TEXT_MAX = 22 + DOUBLE_TEXT_MAX * 9 + 96;
+
+    size_t appendText(char* buf, size_t n, const char* text) {
+        const size_t len = std::strlen(text);
+        std::memcpy(buf + n, text, len);
+        return n + len;
+    }
+
+    size_t appendStats(char* buf, size_t n, const RangeStats& stats, double scale) {
+        n = appendText(buf, n, "sum ");
+        n += formatDouble(stats.sum * scale, buf + n);
+        n = appendText(buf, n, ", avg ");
+        n += formatDouble(stats.average() * scale, buf + n);
+        n = appendText(buf, n, ", min ");
+        n += formatDouble(stats.min * scale, buf + n);
+        n = appendText(buf, n, ", max ");
+        n += formatDouble(stats.max * scale, buf + n);
+        return n;
+    }
+
+    // "<from>..<to> => <value> = sum .., avg .., min .., max .. (rate: sum ..)\n"
+    size_t formatRange(const ParsedLine& data, const RangeStats& stats, char* buf) {
+        std::memcpy(buf, data.date.ptr, data.date.len);
+        size_t n = appendText(buf, data.date.len, " => ");
+        n += formatDouble(data.value, buf + n);
+        n = appendText(buf, n, " = ");
+        n = appendStats(buf, n, stats, data.value);
+        n = appendText(buf, n, " (rate: ");
+        n = appendStats(buf, n, stats, 1);
+        n = appendText(buf, n, ")\n");
+        return n;
+    }
+
+    // Writes query results straight to the output buffers
+    struct StreamSink {
+        OutputBuffer& out;
+        OutputBuffer& err;
+
+        StreamSink(OutputBuffer& o, OutputBuffer& e) : out(o), err(e) {}
+
+        void output(const char* data, size_t len) {
+            out.write(data, len);
+        }
+
+        void result(const ParsedLine& data, double rate) {
+            out.write(data.date.ptr, data.date.len);
+            out.write(" => ", 4);
+            out.putDouble(data.value);
+            out.write(" = ", 3);
+            out.putDouble(data.value * rate);
+            out.put('\n');
+        }
+
+        void fixedResult(const ParsedLine& data, Fixed product) {
+            char buf[FIXED_TAIL_MAX];
+            out.write(data.date.ptr, data.date.len);
+            out.write(buf, formatFixedTail(data, product, buf));
+        }
+
+        void error(BitcoinExchange::QueryError code, const LineSlice& line) {
+            err.write(ERROR_TEXT[code].text, ERROR_TEXT[code].len);
+            if (code == BitcoinExchange::QUERY_BAD_INPUT)
+                err.write(line.ptr, line.len);
+            err.put('\n');
+        }
+    };
+
+    // Appends results and errors alike to one reply buffer
+    struct ReplySink {
+        std::vector<char>& reply;
+
+        explicit ReplySink(std::vector<char>& r) : reply(r) {}
+
+        void output(const char* data, size_t len) {
+            reply.insert(reply.end(), data, data + len);
+        }
+
+        void result(const ParsedLine& data, double rate) {
+            char buf[RESULT_TAIL_MAX];
+            const size_t n = formatResultTail(data, rate, buf);
+            reply.insert(reply.end(), data.date.ptr, data.date.ptr + data.date.len);
+            reply.insert(reply.end(), buf, buf + n);
+        }
+
+        void fixedResult(const ParsedLine& data, Fixed product) {
+            char buf[FIXED_TAIL_MAX];
+            const size_t n = formatFixedTail(data, product, buf);
+            reply.insert(reply.end(), data.date.ptr, data.date.ptr + data.date.len);
+            reply.insert(reply.end(), buf, buf + n);
+        }
+
+        void error(BitcoinExchange::QueryError code, const LineSlice& line) {
+            reply.insert(reply.end(), ERROR_TEXT[code].text, ERROR_TEXT[code].text + ERROR_TEXT[code].len);
+            if (code == BitcoinExchange::QUERY_BAD_INPUT)
+                reply.insert(reply.end(), line.ptr, line.ptr + line.len);
+            reply.push_back('\n');
+        }
+    };
+
+    // Keeps one chunk's output in memory until it is that chunk's turn to be
+    // written. Runs of stdout and stderr text are recorded as segments so the
+    // two streams can be replayed in their original order.
+    struct ChunkSink {
+        struct Segment {
+            bool isError;
+            size_t len;
+        };
+        std::vector<char> text;
+        std::vector<Segment> segments;
+
+        void append(bool isError, const char* data, size_t len) {
+            if (segments.empty() || segments.back().isError != isError) {
+                Segment seg;
+                seg.isError = isError;
+                seg.len = 0;
+                segments.push_back(seg);
+            }
+            text.insert(text.end(), data, data + len);
+            segments.back().len += len;
+        }
+
+        void output(const char* data, size_t len) {
+            append(false, data, len);
+        }
+
+        void result(const ParsedLine& data, double rate) {
+            char buf[RESULT_TAIL_MAX];
+            const size_t n = formatResultTail(data, rate, buf);
+            append(false, data.date.ptr, data.date.len);
+            append(false, buf, n);
+        }
+
+        void fixedResult(const ParsedLine& data, Fixed product) {
+            char buf[FIXED_TAIL_MAX];
+            const size_t n = formatFixedTail(data, product, buf);
+            append(false, data.date.ptr, data.date.len);
+            append(false, buf, n);
+        }
+
+        void error(BitcoinExchange::QueryError code, const LineSlice& line) {
+            append(true, ERROR_TEXT[code].text, ERROR_TEXT[code].len);
+            if (code == BitcoinExchange::QUERY_BAD_INPUT)
+                append(true, line.ptr, line.len);
+            append(true, "\n", 1);
+        }
+
+        void release() {
+            std::vector<char>().swap(text);
+            std::vector<Segment>().swap(segments);
+        }
+
+        void replay(OutputBuffer& out, OutputBuffer& err) const {
+            const char* p = text.empty() ? NULL : &text[0];
+            for (size_t i = 0; i < segments.size(); ++i) {
+                (segments[i].isError ? err : out).write(p, segments[i].len);
+                p += segments[i].len;
+            }
+        }
+    };
+
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        bool done;
+        ChunkSink output;
+        LookupCursor cursor;
+        unsigned long tally[BitcoinExchange::QUERY_ERROR_KINDS];
+        BitcoinExchange::QueryStats stats;
+    };
+
+    // Shared state of one parallel run
+    struct ParallelJob {
+        const BitcoinExchange* self;
+        char delim;
+        bool summary;
+        bool stats;
+        std::vector<Chunk> chunks;
+        size_t next;     // next chunk a worker may claim
+        size_t emitted;  // chunks already written out, in order
+        size_t window;   // how far workers may run ahead of the writer
+        pthread_mutex_t lock;
+        pthread_cond_t changed;
+    };
+
+    // Claims the next chunk, or returns false once all are taken.
+    // Waits while the writer is more than a window behind.
+    bool claimChunk(ParallelJob& job, size_t& index) {
+        pthread_mutex_lock(&job.lock);
+        while (job.next < job.chunks.size() && job.next >= job.emitted + job.window)
+            pthread_cond_wait(&job.changed, &job.lock);
+        index = job.next;
+        const bool ok = index < job.chunks.size();
+        if (ok)
+            ++job.next;
+        pthread_mutex_unlock(&job.lock);
+        return ok;
+    }
+
+    int startThreads(void* (*worker)(void*), ParallelJob& job, std::vector<pthread_t>& threads) {
+        int started = 0;
+        for (; started < static_cast<int>(threads.size()); ++started) {
+            if (pthread_create(&threads[static_cast<size_t>(started)], NULL, worker, &job) != 0)
+                break;
+        }
+        return started;
+    }
+
+    void joinThreads(std::vector<pthread_t>& threads, int started) {
+        for (int i = 0; i < started; ++i)
+            pthread_join(threads[static_cast<size_t>(i)], NULL);
+    }
+}
+
+// Validates one input line and looks up its rate without throwing; the
+// error message, if any, is only formatted by the sink that writes it
+BitcoinExchange::QueryError BitcoinExchange::checkQuery(const LineSlice& line, const char delim, LookupCursor* cursor, ParsedLine& data, double& rate) const {
+    const QueryError code = validateQuery(line, delim, data);
+    if (code != QUERY_OK)
+        return code;
+    if (!findRate(data.day, cursor, data.column, rate))
+        return QUERY_NO_EARLIER_DATE;
+    return QUERY_OK;
+}
+
+// checkQuery in fixed-point mode: the result is the exact product
+BitcoinExchange::QueryError BitcoinExchange::checkFixedQuery(const LineSlice& line, const char delim, LookupCursor* cursor, ParsedLine& data, Fixed& product) const {
+    const QueryError code = validateQuery(line, delim, data);
+    if (code != QUERY_OK)
+        return code;
+    const long index = findIndex(data.day, cursor);
+    if (index < 0)
+        return QUERY_NO_EARLIER_DATE;
+    return fixedProduct(index, data, product);
+}
+
+// amount x the Fixed rate of entry index; a product, or a database rate,
+// beyond the range of Fixed is too large a number
+BitcoinExchange::QueryError BitcoinExchange::fixedProduct(const long index, const ParsedLine& data, Fixed& product) const {
+    if (!multiplyFixed(data.amount, _db->fixedAt(static_cast<size_t>(index), data.column), product))
+        return QUERY_TOO_LARGE;
+    return QUERY_OK;
+}
+
+// checkQuery without the lookup. A Fixed amount is checked as the digits
+// were written, before rounding: "-0.000000001" is not positive and
+// "1000.000000001" is too large, as they are for a double.
+BitcoinExchange::QueryError BitcoinExchange::validateQuery(const LineSlice& line, const char delim, ParsedLine& data) const {
+    if (!splitLine(line, delim, _fixedPoint, data) || !selectColumn(data))
+        return QUERY_BAD_INPUT;
+    if (_fixedPoint ? data.amount < 0 || (data.amount == 0 && data.dropped < 0) : data.value < 0)
+        return QUERY_NOT_POSITIVE;
+    if (_fixedPoint ? data.amount > 1000 * FIXED_ONE || (data.amount == 1000 * FIXED_ONE && data.dropped > 0)
+        : data.value > 1000)
+        return QUERY_TOO_LARGE;
+    return QUERY_OK;
+}
+
+// The column named by the line's asset field, or the one setAsset chose;
+// false for an asset the database has no column for
+bool BitcoinExchange::selectColumn(ParsedLine& data) const {
+    if (data.asset.len == 0) {
+        data.column = _column;
+        return true;
+    }
+    const long column = _db->findColumn(data.asset.ptr, data.asset.len);
+    data.column = static_cast<size_t>(column);
+    return column >= 0;
+}
+
+// A "from..to | value [| asset]" line; from must not be after to
+BitcoinExchange::QueryError BitcoinExchange::checkRange(const LineSlice& line, const char delim, ParsedLine& data, RangeStats& stats) const {
+    LineSlice value;
+    int toDay;
+    if (!splitFields(line, delim, data.date, value))
+        return QUERY_BAD_INPUT;
+    const char* valueEnd = value.ptr + value.len;
+    if (!cutAsset(value.ptr, valueEnd, delim, data.asset))
+        return QUERY_BAD_INPUT;
+    if (data.date.len != 22 || data.date.ptr[10] != '.' || data.date.ptr[11] != '.'
+        || !parseDate(data.date.ptr, 10, data.day) || !parseDate(data.date.ptr + 12, 10, toDay)
+        || data.day > toDay || !parseValue(value.ptr, static_cast<size_t>(valueEnd - value.ptr), data.value)
+        || !selectColumn(data))
+        return QUERY_BAD_INPUT;
+    if (data.value < 0)
+        return QUERY_NOT_POSITIVE;
+    if (data.value > 1000)
+        return QUERY_TOO_LARGE;
+    if (!_db->rangeStats(data.day, toDay, data.column, stats))
+        return QUERY_NO_EARLIER_DATE;
+    return QUERY_OK;
+}
+
+// With a tally, rejected lines are only counted by kind
+template <typename Sink>
+void BitcoinExchange::processQuery(const LineSlice& line, const char delim, Sink& sink, LookupCursor& cursor, unsigned long* tally, QueryStats* stats) const {
+    if (stats) {
+        processTimedQuery(line, delim, sink, cursor, tally, *stats);
+        return;
+    }
+    ParsedLine data;
+    double rate;
+    Fixed product;
+    RangeStats range;
+    const QueryError code = _ranges ? checkRange(line, delim, data, range)
+        : _fixedPoint ? checkFixedQuery(line, delim, _sorted ? &cursor : NULL, data, product)
+        : checkQuery(line, delim, _sorted ? &cursor : NULL, data, rate);
+    if (code == QUERY_OK && _ranges) {
+        char buf[RANGE_TEXT_MAX];
+        sink.output(buf, formatRange(data, range, buf));
+    } else if (code == QUERY_OK && _fixedPoint)
+        sink.fixedResult(data, product);
+    else if (code == QUERY_OK)
+        sink.result(data, rate);
+    else if (tally)
+        ++tally[code];
+    else
+        sink.error(code, line);
+}
+
+// processQuery with each step timed and counted; the output is the same
+template <typename Sink>
+void BitcoinExchange::processTimedQuery(const LineSlice& line, const char delim, Sink& sink, LookupCursor& cursor, unsigned long* tally, QueryStats& stats) const {
+    ++stats.lines;
+    ParsedLine data;
+    RangeStats range;
+    Fixed product = 0;
+    long index = -1;
+    const uint64_t start = monotonicNanos();
+    QueryError code = _ranges ? QUERY_OK : validateQuery(line, delim, data);
+    const uint64_t parsed = monotonicNanos();
+    if (_ranges)
+        code = checkRange(line, delim, data, range);
+    else if (code == QUERY_OK && (index = findIndex(data.day, _sorted ? &cursor : NULL)) < 0)
+        code = QUERY_NO_EARLIER_DATE;
+    else if (code == QUERY_OK && _fixedPoint)
+        code = fixedProduct(index, data, product);
+    const uint64_t looked = monotonicNanos();
+    if (code == QUERY_OK && _ranges) {
+        char buf[RANGE_TEXT_MAX];
+        sink.output(buf, formatRange(data, range, buf));
+    } else if (code == QUERY_OK) {
+        if (_fixedPoint)
+            sink.fixedResult(data, product);
+        else
+            sink.result(data, _db->rateAt(static_cast<size_t>(index), data.column));
+        ++(_db->dayAt(static_cast<size_t>(index)) == data.day ? stats.exact : stats.previous);
+    } else if (tally)
+        ++tally[code];
+    else
+        sink.error(code, line);
+    const uint64_t written = monotonicNanos();
+    ++stats.outcomes[code];
+    stats.parseNs += parsed - start;
+    stats.lookupNs += looked - parsed;
+    stats.outputNs += written - looked;
+    if (code == QUERY_OK || code == QUERY_NO_EARLIER_DATE) {
+        int bucket = 0;
+        for (uint64_t ns = (looked - parsed) >> 5; ns && bucket < QueryStats::LATENCY_BUCKETS - 1; ns >>= 1)
+            ++bucket;
+        ++stats.latency[bucket];
+    }
+}
+
+// Answers one "date | value" line the way processFile would print it,
+// error or not, and appends the reply line to response
+void BitcoinExchange::answerQuery(const LineSlice& line, const char delim, std::vector<char>& response) const {
+    ReplySink sink(response);
+    LookupCursor cursor;
+    processQuery(line, delim, sink, cursor, NULL, NULL);
+}
+
+// Parses, validates and looks up every line of a chunk
+void* BitcoinExchange::queryWorker(void* arg) {
+    ParallelJob& job = *static_cast<ParallelJob*>(arg);
+    size_t index;
+    while (claimChunk(job, index)) {
+        Chunk& chunk = job.chunks[index];
+        LineReader reader(chunk.begin, static_cast<size_t>(chunk.end - chunk.begin));
+        LineSlice line;
+        while (reader.next(line))
+            job.self->processQuery(line, job.delim, chunk.output, chunk.cursor,
+                job.summary ? chunk.tally : NULL, job.stats ? &chunk.stats : NULL);
+        pthread_mutex_lock(&job.lock);
+        chunk.done = true;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+    }
+    return NULL;
+}
+
+// Splits [begin, end) into line-aligned chunks that worker threads process
+// independently against the read-only rate table. This thread writes each
+// chunk's output as soon as it and all chunks before it are finished, so the
+// output is identical to a sequential run.
+void BitcoinExchange::processParallel(const char* begin, const char* end, const char delim, OutputBuffer& out, OutputBuffer& err, LookupCursor& cursor, unsigned long* tally, QueryStats* stats) const {
+    const size_t total = static_cast<size_t>(end - begin);
+    size_t chunkSize = total / (static_cast<size_t>(_threads) * 8);
+    if (chunkSize < (1 << 16))
+        chunkSize = 1 << 16;
+    if (chunkSize > (1 << 20))
+        chunkSize = 1 << 20;
+
+    ParallelJob job;
+    job.self = this;
+    job.delim = delim;
+    job.summary = tally != NULL;
+    job.stats = stats != NULL;
+    for (const char* p = begin; p < end; ) {
+        Chunk chunk;
+        chunk.begin = p;
+        chunk.end = end;
+        chunk.done = false;
+        std::memset(chunk.tally, 0, sizeof(chunk.tally));
+        if (static_cast<size_t>(end - p) > chunkSize) {
+            const char* nl = static_cast<const char*>(std::memchr(p + chunkSize, '\n', static_cast<size_t>(end - p - chunkSize)));
+            if (nl)
+                chunk.end = nl + 1;
+        }
+        job.chunks.push_back(chunk);
+        p = chunk.end;
+    }
+    job.next = 0;
+    job.emitted = 0;
+    job.window = static_cast<size_t>(_threads) * 4;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    std::vector<pthread_t> threads(static_cast<size_t>(_threads));
+    const int started = startThreads(queryWorker, job, threads);
+    const bool threaded = started > 0;
+    if (threaded) {
+        for (size_t i = 0; i < job.chunks.size(); ++i) {
+            pthread_mutex_lock(&job.lock);
+            while (!job.chunks[i].done)
+                pthread_cond_wait(&job.changed, &job.lock);
+            pthread_mutex_unlock(&job.lock);
+            job.chunks[i].output.replay(out, err);
+            job.chunks[i].output.release();
+            cursor.lookups += job.chunks[i].cursor.lookups;
+            cursor.sequential += job.chunks[i].cursor.sequential;
+            for (int kind = 0; tally && kind < QUERY_ERROR_KINDS; ++kind)
+                tally[kind] += job.chunks[i].tally[kind];
+            if (stats)
+                stats->merge(job.chunks[i].stats);
+            pthread_mutex_lock(&job.lock);
+            ++job.emitted;
+            pthread_cond_broadcast(&job.changed);
+            pthread_mutex_unlock(&job.lock);
+        }
+        joinThreads(threads, started);
+    }
+    pthread_cond_destroy(&job.changed);
+    pthread_mutex_destroy(&job.lock);
+    if (!threaded) {
+        // No threads available: do the same work on this one
+        LineReader reader(begin, total);
+        LineSlice line;
+        StreamSink sink(out, err);
+        while (reader.next(line))
+            processQuery(line, delim, sink, cursor, tally, stats);
+    }
 }
 
 void BitcoinExchange::processFile(const std::string* inputFile, const char delimiter) {
     bool isInputFile = (inputFile != NULL);
     std::string filename = isInputFile ? *inputFile : _filename;
     const char delim = isInputFile ? delimiter : _delimiter;
-    std::ifstream file(filename.c_str());
-    if (!file.is_open())
+    uint64_t phaseNs[PHASES] = { 0 };
+    const uint64_t start = monotonicNanos();
+    MappedFile file(filename);
+    if (!file.isOpen())
         throw std::runtime_error(makeErrorString(isInputFile, 0, "could not open file."));
-    std::string line;
+    phaseNs[PHASE_OPEN] = monotonicNanos() - start;
+    LineReader reader(file.data(), file.size());
+    LineSlice line;
     int lineNumber = 1;
-    if (!getline(file, line)) {
-        file.close();
+    if (!reader.next(line))
         throw std::runtime_error(makeErrorString(isInputFile, lineNumber, "failed to read header line."));
-    }
     lineNumber++;
-    std::string dateStr;
-    while (getline(file, line)) {
-        try {
-            std::pair<std::string, double> data = processLine(isInputFile, lineNumber, line, delim);
-            const std::string& date = data.first;
-            double value = data.second;
-            if (value < 0) {
-                throw std::runtime_error(makeErrorString(isInputFile, lineNumber, "not a positive number."));
-            }
-            if (!isInputFile) {
-                _db[date] = value;
-            }
-            else {
-                if (value > 1000) {
-                    throw std::runtime_error(makeErrorString(isInputFile, lineNumber, "too large a number."));
-                }
-                else {
-                    double rate = getRate(isInputFile, date);
-                    std::cout << date << " => " << value << " = " << value * rate << std::endl;
-                }
-            }
-        } catch (const std::exception& e) {
-            if (!isInputFile) {
-                file.close();
-                throw;
-            }
-            else {
-                std::cerr << e.what() << std::endl;
+    if (!isInputFile) {
+        // No complete header line yet: offset 0 makes refresh() start over
+        size_t offset = line.ptr + line.len < reader.end() ? static_cast<size_t>(reader.position() - file.data()) : 0;
+        SharedPtr<RateTable> next(new RateTable);
+        readHeader(line, *next);
+        std::vector<double> rates(next->columns());
+        while (reader.next(line)) {
+            const int day = processRow(lineNumber, line, rates.size(), &rates[0]);
+            next->insert(day, &rates[0]);
+            // A last line without its newline may still be being written:
+            // it is loaded, but refresh() will read it again
+            if (line.ptr + line.len < reader.end()) {
+                offset = static_cast<size_t>(reader.position() - file.data());
+                lineNumber++;
             }
         }
-        lineNumber++;
+        next->freeze();
+        _db.swap(next);
+        recordLoadState(file, offset, lineNumber);
+        return;
+    }
+    // Results and per-line errors are buffered; when both streams end up in
+    // the same place they are tied so the lines stay interleaved as before
+    OutputBuffer out(STDOUT_FILENO, 1 << 20);
+    OutputBuffer err(STDERR_FILENO, 1 << 16);
+    if (OutputBuffer::sameTarget(STDOUT_FILENO, STDERR_FILENO)) {
+        out.tie(&err);
+        err.tie(&out);
+    }
+    LookupCursor cursor;
+    unsigned long counts[QUERY_ERROR_KINDS] = { 0 };
+    unsigned long* tally = _summary ? counts : NULL;
+    QueryStats stats;
+    QueryStats* timing = _stats ? &stats : NULL;
+    const uint64_t queriesStart = monotonicNanos();
+    if (_threads > 1) {
+        processParallel(reader.position(), reader.end(), delim, out, err, cursor, tally, timing);
+    } else {
+        StreamSink sink(out, err);
+        while (reader.next(line))
+            processQuery(line, delim, sink, cursor, tally, timing);
+    }
+    phaseNs[PHASE_QUERIES] = monotonicNanos() - queriesStart;
+    if (_summary) {
+        err.write("errors:", 7);
+        for (int kind = QUERY_BAD_INPUT; kind < QUERY_ERROR_KINDS; ++kind) {
+            char report[64];
+            int n = std::snprintf(report, sizeof(report), "%s %s %lu", kind == QUERY_BAD_INPUT ? "" : ",",
+                ERROR_KIND[kind], counts[kind]);
+            err.write(report, static_cast<size_t>(n));
+        }
+        err.put('\n');
     }
-    file.close();
+    // Dense lookups index the calendar directly and never use the cursor
+    if (_sorted && !_dense) {
+        char report[128];
+        int n = std::snprintf(report, sizeof(report), "merge-join: %lu of %lu lookups took the sequential fast path\n",
+            cursor.sequential, cursor.lookups);
+        err.write(report, static_cast<size_t>(n));
+    }
+    const uint64_t flushStart = monotonicNanos();
+    out.flush();
+    phaseNs[PHASE_FLUSH] = monotonicNanos() - flushStart;
+    phaseNs[PHASE_TOTAL] = monotonicNanos() - start;
+    if (_stats)
+        writeStats(err, stats, phaseNs, filename);
+    err.flush();
 }
 
-double BitcoinExchange::getRate(const bool isInputFile, const std::string& date) const {
-    std::map<std::string, double>::const_iterator it = _db.find(date);
-    if (it != _db.end())
-        return it->second;
-    it = _db.lower_bound(date);
-    if (it == _db.begin())
-        throw std::runtime_error(makeErrorString(isInputFile, 0, "No lower date found in DB"));
-    --it;
-    return it->second;
+// One JSON object; "queries" is wall time, parse/lookup/output are summed
+// per line over all threads
+void BitcoinExchange::writeStats(OutputBuffer& err, const QueryStats& stats, const uint64_t* phaseNs, const std::string& input) const {
+    // The input path and the asset name come from outside: escaped
+    const std::string names = "{\"input\":" + jsonString(input) + ",\"asset\":" + jsonString(_db->columnName(_column)) + ",";
+    err.write(names.data(), names.size());
+    std::vector<char> json(4096);
+    int n = std::snprintf(&json[0], json.size(),
+        "\"phases_ms\":{\"db_load\":%.3f,\"index\":%.3f,\"open_input\":%.3f,\"queries\":%.3f,"
+        "\"parse\":%.3f,\"lookup\":%.3f,\"output\":%.3f,\"flush\":%.3f,\"total\":%.3f},"
+        "\"lines\":{\"read\":%lu,\"accepted\":%lu,\"bad_input\":%lu,\"not_positive\":%lu,"
+        "\"too_large\":%lu,\"no_earlier_date\":%lu},"
+        "\"db\":{\"rows\":%lu,\"assets\":%lu},"
+        "\"lookups\":{\"exact\":%lu,\"previous_date\":%lu},"
+        "\"lookup_latency_ns\":[",
+        _loadNs / 1e6, _indexNs / 1e6, phaseNs[PHASE_OPEN] / 1e6, phaseNs[PHASE_QUERIES] / 1e6,
+        stats.parseNs / 1e6, stats.lookupNs / 1e6, stats.outputNs / 1e6, phaseNs[PHASE_FLUSH] / 1e6, phaseNs[PHASE_TOTAL] / 1e6,
+        stats.lines, stats.outcomes[QUERY_OK], stats.outcomes[QUERY_BAD_INPUT], stats.outcomes[QUERY_NOT_POSITIVE],
+        stats.outcomes[QUERY_TOO_LARGE], stats.outcomes[QUERY_NO_EARLIER_DATE],
+        static_cast<unsigned long>(_db->size()), static_cast<unsigned long>(_db->columns()),
+        stats.exact, stats.previous);
+    // Bucket i counts lookups under 32 << i ns; the last one is open-ended
+    for (int i = 0; i < QueryStats::LATENCY_BUCKETS; ++i) {
+        if (i + 1 < QueryStats::LATENCY_BUCKETS)
+            n += std::snprintf(&json[n], json.size() - n, "%s{\"lt\":%lu,\"count\":%lu}", i ? "," : "",
+                32ul << i, stats.latency[i]);
+        else
+            n += std::snprintf(&json[n], json.size() - n, ",{\"lt\":null,\"count\":%lu}", stats.latency[i]);
+    }
+    n += std::snprintf(&json[n], json.size() - n, "]}\n");
+    err.write(&json[0], static_cast<size_t>(n));
 }
 
-bool isLeap(int year) {
-    // 4で割り切れ、かつ100で割り切れない年、または400で割り切れる年
-    return (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+// Hash of the whole ingested range: an edit anywhere in what was already
+// loaded, even one that keeps every length, changes it. It reads the
+// prefix once per refresh, which is still far less than parsing it.
+static uint64_t prefixFingerprint(const char* data, size_t offset) {
+    return fnv1a(data, offset, fnv1a(&offset, sizeof(offset)));
 }
 
-bool BitcoinExchange::isValidDate(const std::string& date) const {
-    if (date.size() != 10) return false;
-    for (int i = 0; i < 10; ++i) {
-        if (i == 4 || i == 7) {
-            if (date[i] != '-') return false;
-        } else {
-            if (!isdigit(date[i])) return false;
-        }
-    }
-    std::istringstream iss(date);
-    int year, month, day;
-    char d1, d2; // ハイフンを読み飛ばすためのダミー
+void BitcoinExchange::recordLoadState(const MappedFile& file, size_t offset, int nextLine) {
+    struct stat st;
+    std::memset(&st, 0, sizeof(st));
+    stat(_filename.c_str(), &st);
+    _load.offset = offset;
+    _load.size = file.size();
+    _load.nextLine = nextLine;
+    _load.device = static_cast<unsigned long>(st.st_dev);
+    _load.inode = static_cast<unsigned long>(st.st_ino);
+    _load.fingerprint = prefixFingerprint(file.data(), offset);
+}
 
-    // iss >> year >> d1 >> month >> d2 >> day のように一度に読み込む
-    // iss.fail()で、数値として読めなかった場合（例: "202a-10-10"）をチェック
-    if (!(iss >> year >> d1 >> month >> d2 >> day) || iss.fail()) {
+// True if file still starts with exactly what was loaded from it
+bool BitcoinExchange::matchesLoadState(const MappedFile& file) const {
+    struct stat st;
+    if (_load.offset == 0 || stat(_filename.c_str(), &st) != 0)
         return false;
-    }
+    return static_cast<unsigned long>(st.st_dev) == _load.device
+        && static_cast<unsigned long>(st.st_ino) == _load.inode
+        && file.size() >= _load.offset
+        && prefixFingerprint(file.data(), _load.offset) == _load.fingerprint;
+}
 
-    // --- ③ 日付のルールと照合 ---
-    // 年と月の基本的な範囲チェック
-    if (year < 2009 || year > 2100) return false;
-    if (month < 1 || month > 12) return false;
+// Parses the whole database again, keeping this object's settings. The
+// new table is made ready, asset column included, before it replaces the
+// current one, so a throw (the asset is gone, say) leaves this unchanged.
+void BitcoinExchange::reload() {
+    BitcoinExchange fresh(_filename, _delimiter);
+    fresh.setAsset(_asset);
+    fresh.setDenseLookup(_dense);
+    fresh.setRangeQueries(_ranges);
+    fresh.setFixedPoint(_fixedPoint);
+    _db.swap(fresh._db);
+    _column = fresh._column;
+    _load = fresh._load;
+    _indexNs += fresh._indexNs;
+}
 
-    // 日の範囲チェック
-    int daysInMonth;
-    switch (month) {
-        case 1: case 3: case 5: case 7: case 8: case 10: case 12:
-            daysInMonth = 31;
-            break;
-        case 4: case 6: case 9: case 11:
-            daysInMonth = 30;
-            break;
-        case 2: // 2月はうるう年を考慮
-            if (isLeap(year)) {
-                daysInMonth = 29;
-            } else {
-                daysInMonth = 28;
-            }
-            break;
-        default:
-            return false;
+// Brings the table up to date with the database file.
+// Rows appended since the last load are parsed on their own and merged in;
+// a file that was truncated, replaced or changed before the ingested offset
+// is loaded again from scratch. A bad appended row throws like it does at
+// construction, and leaves the table as it was.
+BitcoinExchange::RefreshResult BitcoinExchange::refresh() {
+    MappedFile file(_filename);
+    if (!file.isOpen())
+        throw std::runtime_error(makeErrorString(false, 0, "could not open file."));
+    if (!matchesLoadState(file)) {
+        reload();
+        return REFRESH_RELOADED;
     }
-
-    if (day < 1 || day > daysInMonth) {
-        return false;
+    if (file.size() == _load.size)
+        return REFRESH_UNCHANGED;
+    int lineNumber = _load.nextLine;
+    if (lineNumber == 0) {
+        lineNumber = 1;
+        for (const char* p = file.data(); (p = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(file.data() + _load.offset - p)))) != NULL; ++p)
+            ++lineNumber;
+    }
+    const size_t columns = _db->columns();
+    std::vector<int> days;
+    std::vector<double> rates;
+    std::vector<double> row(columns);
+    LineReader reader(file.data() + _load.offset, file.size() - _load.offset);
+    LineSlice line;
+    size_t offset = _load.offset;
+    while (reader.next(line)) {
+        const bool complete = line.ptr + line.len < reader.end();
+        try {
+            days.push_back(processRow(lineNumber, line, columns, &row[0]));
+        } catch (const std::exception&) {
+            // An unterminated last row may be half-written; try it next time
+            if (!complete)
+                break;
+            throw;
+        }
+        rates.insert(rates.end(), row.begin(), row.end());
+        if (complete) {
+            offset = static_cast<size_t>(reader.position() - file.data());
+            lineNumber++;
+        }
     }
+    // Copies made before this, and readers of this one, keep the table as
+    // it was; the merged one is published with its indexes built
+    SharedPtr<RateTable> next = draft();
+    for (size_t i = 0; i < days.size(); ++i)
+        next->insert(days[i], &rates[i * columns]);
+    next->freeze();
+    if (_dense)
+        next->buildCalendar(RateTable::dayNumber(MAX_YEAR, 12, 31));
+    if (_ranges)
+        next->buildRanges();
+    if (_fixedPoint)
+        next->buildFixed();
+    _db.swap(next);
+    recordLoadState(file, offset, lineNumber);
+    return REFRESH_APPENDED;
+}
 
-    // 全てのチェックを通過
-    return true;
+// Non-throwing lookup of the rate in effect on a RateTable day number,
+// using the same calendar/search path as queries do
+bool BitcoinExchange::rateOn(const int day, double& rate) const {
+    return findRate(day, NULL, _column, rate);
+}
+
+// Sum, min and max of the selected asset's rate over the days
+// [fromDay, toDay], each day taking the rate in effect on it (as rateOn).
+// False if fromDay is before the first entry.
+bool BitcoinExchange::rateRange(const int fromDay, const int toDay, RangeStats& stats) const {
+    return _db->rangeStats(fromDay, toDay, _column, stats);
+}
+
+// Number of dated entries in the rate table
+size_t BitcoinExchange::size() const {
+    return _db->size();
 }
 
-bool BitcoinExchange::isValidValue(const std::string& value) const {
-    // 正規表現 [-+]?\d{1,17}(\.\d{1,17})?([eE][-+]?\d{1,3})? に沿った手動チェック
-    size_t i = 0;
-    if (value.empty()) return false;
-    if (value[0] == '-' || value[0] == '+') i = 1;
-    // 整数部（1～17桁）
-    size_t intStart = i;
-    while (i < value.size() && isdigit(value[i]) && (i - intStart) < 17) ++i;
-    if ((i - intStart) < 1 || (i - intStart) > 17) return false;
-    // 小数部（任意、1～17桁）
-    if (i < value.size() && value[i] == '.') {
-        ++i;
-        size_t fracStart = i;
-        while (i < value.size() && isdigit(value[i]) && (i - fracStart) < 17) ++i;
-        if ((i - fracStart) < 1 || (i - fracStart) > 17) return false;
-    }
-    // 指数部（任意、e/E[-+]?1～3桁）
-    if (i < value.size() && (value[i] == 'e' || value[i] == 'E')) {
-        ++i;
-        if (i < value.size() && (value[i] == '-' || value[i] == '+')) ++i;
-        size_t expStart = i;
-        while (i < value.size() && isdigit(value[i]) && (i - expStart) < 3) ++i;
-        if ((i - expStart) < 1 || (i - expStart) > 3) return false;
-    }
-    if (i != value.size()) return false;
-    // strtodで変換し、endが文字列終端であることを確認
-    char* end;
-    errno = 0;
-    std::strtod(value.c_str(), &end);
-    if (end != value.c_str() + value.size()) return false;
-    if (errno == ERANGE) return false; // オーバーフロー・アンダーフロー検出
+// Table index of the entry in effect on day, -1 if there is none
+long BitcoinExchange::findIndex(const int day, LookupCursor* cursor) const {
+    return _db->hasCalendar() ? _db->calendarFloor(day)
+        : cursor ? _db->findFloor(day, *cursor) : _db->findFloor(day);
+}
+
+// The rate on day, or failing that on the closest earlier day in the table
+bool BitcoinExchange::findRate(const int day, LookupCursor* cursor, const size_t column, double& rate) const {
+    const long index = findIndex(day, cursor);
+    if (index < 0)
+        return false;
+    rate = _db->rateAt(static_cast<size_t>(index), column);
     return true;
 }
@@ -2,28 +2,123 @@
 #define BITCOINEXCHANGE_HPP
 
 #include <string>
-#include <map>
+#include <vector>
+#include <stdint.h>
 #include <cmath>
 #include <limits>
+#include "RateTable.hpp"
+#include "SharedPtr.hpp"
+#include "LineReader.hpp"
+#include "LineParser.hpp"
+#include "OutputBuffer.hpp"
+
+class MappedFile;
 
 class BitcoinExchange {
 public:
+    enum RefreshResult {
+        REFRESH_UNCHANGED,  // the file is as it was
+        REFRESH_APPENDED,   // new rows at the end were merged in
+        REFRESH_RELOADED    // the file was truncated or rewritten; parsed again
+    };
+    // Why an input line got no result, in the order the checks are made
+    enum QueryError {
+        QUERY_OK,
+        QUERY_BAD_INPUT,
+        QUERY_NOT_POSITIVE,
+        QUERY_TOO_LARGE,
+        QUERY_NO_EARLIER_DATE,
+        QUERY_ERROR_KINDS
+    };
+
+    // Counters of one processFile run, kept only with setStats(true).
+    // Times are summed over worker threads and include clock overhead.
+    struct QueryStats {
+        enum { LATENCY_BUCKETS = 16 };  // < 32 ns, then powers of two
+        QueryStats();
+        void merge(const QueryStats& other);
+        unsigned long lines;
+        unsigned long outcomes[QUERY_ERROR_KINDS];  // lines per QueryError
+        unsigned long exact;            // the date itself is in the table
+        unsigned long previous;         // answered from an earlier date
+        uint64_t parseNs;
+        uint64_t lookupNs;
+        uint64_t outputNs;
+        unsigned long latency[LATENCY_BUCKETS];
+    };
+
     BitcoinExchange(const std::string& filename, char delimiter);
+    BitcoinExchange(const std::string& filename, char delimiter, const std::string& snapshot);
     BitcoinExchange(const BitcoinExchange& other);
     BitcoinExchange& operator=(const BitcoinExchange& other);
     ~BitcoinExchange();
     void processFile(const std::string* p_filename = NULL, const char delimiter = ',');
+    void setThreadCount(int threads);
+    void setDenseLookup(bool enabled);
+    void setSortedLookup(bool enabled);
+    void setErrorSummary(bool enabled);
+    void setAsset(const std::string& name);
+    void setRangeQueries(bool enabled);
+    void setStats(bool enabled);
+    void setFixedPoint(bool enabled);
+    size_t assetCount() const;
+    const std::string& assetName(size_t index) const;
+    void saveSnapshot(const std::string& snapshot) const;
+    void answerQuery(const LineSlice& line, const char delim, std::vector<char>& response) const;
+    RefreshResult refresh();
+    bool rateOn(const int day, double& rate) const;
+    bool rateRange(const int fromDay, const int toDay, RangeStats& stats) const;
+    size_t size() const;
 private:
+    // How much of the database file _db reflects, so refresh() can pick
+    // up rows appended since without parsing the rest again
+    struct LoadState {
+        size_t offset;          // bytes ingested; always the start of a line
+        size_t size;            // file size when last read
+        int nextLine;           // line number at offset, 0 if not counted yet
+        unsigned long device;
+        unsigned long inode;
+        uint64_t fingerprint;   // hash of the bytes [0, offset)
+    };
+    void recordLoadState(const MappedFile& file, size_t offset, int nextLine);
+    bool matchesLoadState(const MappedFile& file) const;
+    void reload();
+    QueryError checkQuery(const LineSlice& line, const char delim, LookupCursor* cursor, ParsedLine& data, double& rate) const;
+    QueryError checkRange(const LineSlice& line, const char delim, ParsedLine& data, RangeStats& stats) const;
+    QueryError checkFixedQuery(const LineSlice& line, const char delim, LookupCursor* cursor, ParsedLine& data, Fixed& product) const;
+    QueryError fixedProduct(const long index, const ParsedLine& data, Fixed& product) const;
+    QueryError validateQuery(const LineSlice& line, const char delim, ParsedLine& data) const;
+    bool selectColumn(ParsedLine& data) const;
+    template <typename Sink>
+    void processQuery(const LineSlice& line, const char delim, Sink& sink, LookupCursor& cursor, unsigned long* tally, QueryStats* stats) const;
+    template <typename Sink>
+    void processTimedQuery(const LineSlice& line, const char delim, Sink& sink, LookupCursor& cursor, unsigned long* tally, QueryStats& stats) const;
+    void processParallel(const char* begin, const char* end, const char delim, OutputBuffer& out, OutputBuffer& err, LookupCursor& cursor, unsigned long* tally, QueryStats* stats) const;
+    void writeStats(OutputBuffer& err, const QueryStats& stats, const uint64_t* phaseNs, const std::string& input) const;
+    static void* queryWorker(void* arg);
     std::string makeErrorString(const bool isInputFile, const int lineNumber, const std::string& msg) const;
-    double getRate(const bool isInputFile, const std::string& date) const;
-    bool isValidDate(const std::string& date) const;
-    bool isValidValue(const std::string& value) const;
+    long findIndex(const int day, LookupCursor* cursor) const;
+    bool findRate(const int day, LookupCursor* cursor, const size_t column, double& rate) const;
     bool printError(const std::string* p_filename, const int lineNumber, const std::string& msg) const;
-    std::pair<std::string, double> processLine(const bool isInputFile, const int lineNumber, const std::string& line, const char delim) const;
+    void readHeader(const LineSlice& line, RateTable& db) const;
+    int processRow(const int lineNumber, const LineSlice& line, const size_t columns, double* rates) const;
     BitcoinExchange();
-    std::map<std::string, double> _db;
+    SharedPtr<RateTable> draft() const;
+    SharedPtr<RateTable> _db;   // shared by copies; replaced, never changed
     std::string _filename;
     char _delimiter;
+    int _threads;
+    bool _dense;
+    bool _sorted;
+    bool _summary;
+    bool _ranges;
+    bool _stats;
+    bool _fixedPoint;
+    uint64_t _loadNs;       // database load, always measured
+    uint64_t _indexNs;      // dense calendar and range index builds
+    std::string _asset;     // empty: the first column
+    size_t _column;
+    LoadState _load;
 };
 
 #endif // BITCOINEXCHANGE_HPP
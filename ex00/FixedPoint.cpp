@@ -0,0 +1,184 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include "FixedPoint.hpp"
+
+static const size_t MAX_VALUE_LEN = 1 + 17 + 1 + 17 + 1 + 1 + 3;
+static const uint64_t MAGNITUDE_MAX = static_cast<uint64_t>(FIXED_MAX);
+static const uint64_t LOW_32 = 0xffffffffu;
+
+static inline bool isDigit(char c) {
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+// units = units * 10 + digit; false instead of going past FIXED_MAX
+static inline bool appendDigit(uint64_t& units, unsigned digit) {
+    if (units > (MAGNITUDE_MAX - digit) / 10)
+        return false;
+    units = units * 10 + digit;
+    return true;
+}
+
+// Whether strtod overflows or underflows on the text, as parseValue
+// checks; only asked for magnitudes near the ends of the double range
+static bool outOfDoubleRange(const char* str, size_t len) {
+    char buf[MAX_VALUE_LEN + 1];
+    std::memcpy(buf, str, len);
+    buf[len] = '\0';
+    errno = 0;
+    std::strtod(buf, NULL);
+    return errno == ERANGE;
+}
+
+bool parseFixed(const char* str, size_t len, Fixed& value, int* dropped) {
+    // parseValue と同じ書式。数字はそのまま整数として積み上げる
+    unsigned char digits[MAX_VALUE_LEN];
+    size_t count = 0;
+    size_t i = 0;
+    bool negative = false;
+    if (len == 0 || len > MAX_VALUE_LEN) return false;
+    if (str[0] == '-' || str[0] == '+') {
+        negative = (str[0] == '-');
+        i = 1;
+    }
+    size_t start = i;
+    for (; i < len && isDigit(str[i]); ++i)
+        digits[count++] = static_cast<unsigned char>(str[i] - '0');
+    if (i - start < 1 || i - start > 17) return false;
+    int exponent = 0;
+    if (i < len && str[i] == '.') {
+        start = ++i;
+        for (; i < len && isDigit(str[i]); ++i)
+            digits[count++] = static_cast<unsigned char>(str[i] - '0');
+        if (i - start < 1 || i - start > 17) return false;
+        exponent = -static_cast<int>(i - start);
+    }
+    if (i < len && (str[i] == 'e' || str[i] == 'E')) {
+        ++i;
+        bool expNegative = false;
+        if (i < len && (str[i] == '-' || str[i] == '+')) {
+            expNegative = (str[i] == '-');
+            ++i;
+        }
+        start = i;
+        int e = 0;
+        for (; i < len && isDigit(str[i]); ++i) {
+            if (i - start < 3)
+                e = e * 10 + (str[i] - '0');
+        }
+        if (i - start < 1 || i - start > 3) return false;
+        exponent += expNegative ? -e : e;
+    }
+    if (i != len) return false;
+    // A nonzero value lies in [10^order, 10^(order + 1)); well inside the
+    // double range parseValue accepts it, so strtod is rarely needed
+    size_t first = 0;
+    while (first < count && digits[first] == 0)
+        ++first;
+    const int order = exponent + static_cast<int>(count - first) - 1;
+    if (first < count && (order >= 307 || order <= -307) && outOfDoubleRange(str, len))
+        return false;
+
+    // The value is digits x 10^shift units; digits past the last unit are
+    // only looked at to round
+    const int shift = exponent + FIXED_DECIMALS;
+    const long kept = static_cast<long>(count) + (shift < 0 ? shift : 0);
+    uint64_t units = 0;
+    bool saturated = false;
+    int excess = 0;     // sign of the exact magnitude minus units
+    for (long k = 0; k < kept && !saturated; ++k)
+        saturated = !appendDigit(units, digits[k]);
+    for (int k = 0; k < shift && units != 0 && !saturated; ++k)
+        saturated = !appendDigit(units, 0);
+    if (!saturated && kept < 0)
+        excess = first < count ? 1 : 0;
+    else if (!saturated && static_cast<size_t>(kept) < count) {
+        const unsigned next = digits[kept];
+        bool rest = false;
+        for (size_t k = static_cast<size_t>(kept) + 1; k < count; ++k)
+            rest = rest || digits[k] != 0;
+        excess = next || rest ? 1 : 0;
+        // 四捨五入ではなく偶数丸め (ties to even)
+        if (next > 5 || (next == 5 && (rest || (units & 1)))) {
+            saturated = ++units > MAGNITUDE_MAX;
+            excess = -1;
+        }
+    }
+    const Fixed magnitude = saturated ? FIXED_MAX : static_cast<Fixed>(units);
+    value = negative ? -magnitude : magnitude;
+    if (dropped)
+        *dropped = saturated ? 0 : negative ? -excess : excess;
+    return true;
+}
+
+static inline uint64_t magnitudeOf(Fixed value) {
+    return value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+}
+
+// Both operands are below 2^63 and FIXED_ONE below 2^27, so the exact
+// product fits in 126 bits and one division by FIXED_ONE brings it back;
+// the 128-bit arithmetic is done in 32-bit limbs to stay within C++98.
+bool multiplyFixed(Fixed a, Fixed b, Fixed& product) {
+    const uint64_t x = magnitudeOf(a);
+    const uint64_t y = magnitudeOf(b);
+    if (x >= MAGNITUDE_MAX || y >= MAGNITUDE_MAX)
+        return false;
+    const uint64_t x0 = x & LOW_32;
+    const uint64_t x1 = x >> 32;
+    const uint64_t y0 = y & LOW_32;
+    const uint64_t y1 = y >> 32;
+    const uint64_t p00 = x0 * y0;
+    const uint64_t p01 = x0 * y1;
+    const uint64_t p10 = x1 * y0;
+    const uint64_t mid = (p00 >> 32) + (p01 & LOW_32) + (p10 & LOW_32);
+    const uint64_t hi = x1 * y1 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    const uint64_t lo = (p00 & LOW_32) | (mid << 32);
+    // A quotient of 2^64 or more cannot be a Fixed anyway
+    const uint64_t divisor = static_cast<uint64_t>(FIXED_ONE);
+    if (hi >= divisor)
+        return false;
+    // Long division of hi:lo by FIXED_ONE, 32 bits at a time
+    uint64_t rem = hi;
+    const uint64_t q1 = ((rem << 32) | (lo >> 32)) / divisor;
+    rem = ((rem << 32) | (lo >> 32)) % divisor;
+    const uint64_t q0 = ((rem << 32) | (lo & LOW_32)) / divisor;
+    rem = ((rem << 32) | (lo & LOW_32)) % divisor;
+    uint64_t units = (q1 << 32) | q0;
+    if (rem * 2 > divisor || (rem * 2 == divisor && (units & 1)))
+        ++units;
+    if (units >= MAGNITUDE_MAX)
+        return false;
+    product = (a < 0) != (b < 0) ? -static_cast<Fixed>(units) : static_cast<Fixed>(units);
+    return true;
+}
+
+size_t formatFixed(Fixed value, char* out) {
+    size_t n = 0;
+    if (value < 0)
+        out[n++] = '-';
+    const uint64_t units = magnitudeOf(value);
+    uint64_t whole = units / static_cast<uint64_t>(FIXED_ONE);
+    uint64_t fraction = units % static_cast<uint64_t>(FIXED_ONE);
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + whole % 10);
+        whole /= 10;
+    } while (whole);
+    while (count)
+        out[n++] = digits[--count];
+    if (fraction) {
+        int decimals = FIXED_DECIMALS;
+        while (fraction % 10 == 0) {
+            fraction /= 10;
+            --decimals;
+        }
+        out[n++] = '.';
+        for (int k = decimals - 1; k >= 0; --k) {
+            out[n + static_cast<size_t>(k)] = static_cast<char>('0' + fraction % 10);
+            fraction /= 10;
+        }
+        n += static_cast<size_t>(decimals);
+    }
+    return n;
+}
@@ -0,0 +1,39 @@
+#ifndef FIXEDPOINT_HPP
+#define FIXEDPOINT_HPP
+
+#include <cstddef>
+#include <stdint.h>
+
+// Decimal fixed-point numbers: a count of 10^-8 units in a signed 64-bit
+// integer, so every value with up to 8 decimals is exact and arithmetic
+// gives the same digits on every platform.
+// Rounding is always to the nearest unit, ties to even.
+typedef int64_t Fixed;
+
+static const int FIXED_DECIMALS = 8;
+static const Fixed FIXED_ONE = 100000000;
+// Stands for every magnitude too large to represent, never for a value
+static const Fixed FIXED_MAX = static_cast<Fixed>((static_cast<uint64_t>(1) << 63) - 1);
+
+// Longest text formatFixed can produce, including a terminating NUL
+static const size_t FIXED_TEXT_MAX = 24;
+
+// Same syntax as parseValue, [-+]?\d{1,17}(\.\d{1,17})?([eE][-+]?\d{1,3})?,
+// converted straight from the digits: rounded to 8 decimals, and
+// saturated to +-FIXED_MAX when the magnitude is out of range.
+// Like parseValue, false for what overflows or underflows a double.
+// dropped, if given, is set to the sign of the exact value minus value
+// (0 when nothing was rounded away or value is saturated), so limits can
+// be checked against the digits as written.
+bool parseFixed(const char* str, size_t len, Fixed& value, int* dropped = NULL);
+
+// a * b rounded to 8 decimals from the exact 128-bit product.
+// False if the result (or an operand) is out of range.
+bool multiplyFixed(Fixed a, Fixed b, Fixed& product);
+
+// Plain decimal without exponent or trailing fractional zeros ("0.9",
+// "47115.93", "-3"). Returns the number of characters written to out
+// (no NUL terminator).
+size_t formatFixed(Fixed value, char* out);
+
+#endif // FIXEDPOINT_HPP
@@ -0,0 +1,320 @@
+// Differential test: parseFixed, multiplyFixed and formatFixed against a
+// reference that does the same decimal arithmetic on digit strings,
+// RateTable::buildFixed against parsing the text the rates came from, and
+// "btc --fixed" against double mode on which amounts it turns away.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include "BitcoinExchange.hpp"
+#include "FixedPoint.hpp"
+#include "LineParser.hpp"
+#include "RateTable.hpp"
+#include "TestSupport.hpp"
+
+static long g_parsed = 0;
+static long g_products = 0;
+static long g_rates = 0;
+static long g_queries = 0;
+
+static std::string digitsOf(uint64_t n) {
+    std::string s;
+    do {
+        s.insert(s.begin(), static_cast<char>('0' + n % 10));
+        n /= 10;
+    } while (n);
+    return s;
+}
+
+static std::string stripZeros(const std::string& digits) {
+    const size_t first = digits.find_first_not_of('0');
+    return first == std::string::npos ? "0" : digits.substr(first);
+}
+
+static std::string fixedText(Fixed value) {
+    return value < 0 ? "-" + digitsOf(0 - static_cast<uint64_t>(value)) : digitsOf(static_cast<uint64_t>(value));
+}
+
+// Digit string to Fixed, or false if it is FIXED_MAX or more
+static bool refUnits(const std::string& digits, uint64_t& units) {
+    const std::string s = stripZeros(digits);
+    const std::string max = digitsOf(static_cast<uint64_t>(FIXED_MAX));
+    if (s.size() > max.size() || (s.size() == max.size() && s >= max))
+        return false;
+    units = 0;
+    for (size_t i = 0; i < s.size(); ++i)
+        units = units * 10 + static_cast<unsigned>(s[i] - '0');
+    return true;
+}
+
+// Drops the last "drop" digits of an integer digit string, rounding to
+// nearest with ties to even
+static std::string refRound(const std::string& digits, long drop) {
+    std::string padded = digits;
+    if (drop >= static_cast<long>(padded.size()))
+        padded.insert(0, static_cast<size_t>(drop) - padded.size() + 1, '0');
+    std::string kept = padded.substr(0, padded.size() - static_cast<size_t>(drop));
+    const std::string dropped = padded.substr(kept.size());
+    if (dropped.empty())
+        return kept;
+    const bool rest = dropped.find_first_not_of('0', 1) != std::string::npos;
+    const bool odd = (kept[kept.size() - 1] - '0') % 2 == 1;
+    if (dropped[0] > '5' || (dropped[0] == '5' && (rest || odd))) {
+        size_t i = kept.size();
+        while (i > 0 && kept[i - 1] == '9')
+            kept[--i] = '0';
+        if (i == 0)
+            kept.insert(kept.begin(), '1');
+        else
+            ++kept[i - 1];
+    }
+    return kept;
+}
+
+// Reference conversion of a text that matches the value syntax
+static Fixed refParse(const std::string& text) {
+    size_t i = 0;
+    const bool negative = text[0] == '-';
+    if (text[0] == '-' || text[0] == '+')
+        i = 1;
+    std::string digits;
+    for (; i < text.size() && text[i] != 'e' && text[i] != 'E'; ++i) {
+        if (text[i] != '.')
+            digits += text[i];
+    }
+    const size_t point = text.find('.');
+    const size_t mark = text.find_first_of("eE");
+    long exponent = point == std::string::npos ? 0 : -static_cast<long>((mark == std::string::npos ? text.size() : mark) - point - 1);
+    if (mark != std::string::npos)
+        exponent += std::strtol(text.c_str() + mark + 1, NULL, 10);
+    const long shift = exponent + FIXED_DECIMALS;
+    std::string units = digits;
+    if (shift >= 0) {
+        // Enough zeros to saturate are as good as all of them
+        if (stripZeros(units) != "0")
+            units.append(static_cast<size_t>(shift < 40 ? shift : 40), '0');
+    } else
+        units = refRound(units, -shift);
+    uint64_t magnitude;
+    const Fixed value = refUnits(units, magnitude) ? static_cast<Fixed>(magnitude) : FIXED_MAX;
+    return negative ? -value : value;
+}
+
+static bool refMultiply(Fixed a, Fixed b, Fixed& product) {
+    if (a == FIXED_MAX || a == -FIXED_MAX || b == FIXED_MAX || b == -FIXED_MAX)
+        return false;
+    const std::string x = digitsOf(a < 0 ? 0 - static_cast<uint64_t>(a) : static_cast<uint64_t>(a));
+    const std::string y = digitsOf(b < 0 ? 0 - static_cast<uint64_t>(b) : static_cast<uint64_t>(b));
+    std::string digits(x.size() + y.size(), '0');
+    std::vector<int> sum(x.size() + y.size(), 0);
+    for (size_t i = 0; i < x.size(); ++i)
+        for (size_t j = 0; j < y.size(); ++j)
+            sum[i + j + 1] += (x[i] - '0') * (y[j] - '0');
+    for (size_t k = sum.size() - 1; k > 0; --k) {
+        sum[k - 1] += sum[k] / 10;
+        sum[k] %= 10;
+    }
+    for (size_t k = 0; k < sum.size(); ++k)
+        digits[k] = static_cast<char>('0' + sum[k]);
+    uint64_t units;
+    if (!refUnits(refRound(digits, FIXED_DECIMALS), units))
+        return false;
+    product = (a < 0) != (b < 0) ? -static_cast<Fixed>(units) : static_cast<Fixed>(units);
+    return true;
+}
+
+static std::string refFormat(Fixed value) {
+    std::string digits = digitsOf(value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value));
+    if (digits.size() <= static_cast<size_t>(FIXED_DECIMALS))
+        digits.insert(0, FIXED_DECIMALS + 1 - digits.size(), '0');
+    std::string text = digits.substr(0, digits.size() - FIXED_DECIMALS);
+    std::string fraction = digits.substr(text.size());
+    fraction.erase(fraction.find_last_not_of('0') + 1);
+    if (!fraction.empty())
+        text += "." + fraction;
+    return value < 0 ? "-" + text : text;
+}
+
+static std::string randomDigits(size_t count) {
+    std::string s;
+    for (size_t i = 0; i < count; ++i)
+        s += static_cast<char>('0' + nextRandom() % 10);
+    return s;
+}
+
+// A text that matches the value syntax, with most of the interesting
+// cases near the 8th decimal and near the top of the range
+static std::string randomValueText() {
+    std::string text;
+    const uint64_t sign = nextRandom() % 4;
+    if (sign == 1)
+        text += '-';
+    else if (sign == 2)
+        text += '+';
+    text += randomDigits(1 + static_cast<size_t>(nextRandom() % 4 ? nextRandom() % 6 : nextRandom() % 17));
+    if (nextRandom() % 4) {
+        std::string fraction = randomDigits(1 + static_cast<size_t>(nextRandom() % 4 ? nextRandom() % 10 : nextRandom() % 17));
+        // Exact ties are rare in random digits
+        if (fraction.size() > 8 && nextRandom() % 3 == 0)
+            fraction = fraction.substr(0, 8) + "5" + std::string(fraction.size() - 9, '0');
+        text += "." + fraction;
+    }
+    if (nextRandom() % 5 == 0) {
+        text += nextRandom() % 2 ? 'e' : 'E';
+        const uint64_t expSign = nextRandom() % 3;
+        if (expSign)
+            text += expSign == 1 ? '-' : '+';
+        text += nextRandom() % 8 ? digitsOf(nextRandom() % 25) : randomDigits(3);
+    }
+    return text;
+}
+
+static Fixed randomFixed() {
+    const uint64_t magnitude = nextRandom() >> (1 + nextRandom() % 63);
+    return nextRandom() % 4 == 0 ? -static_cast<Fixed>(magnitude) : static_cast<Fixed>(magnitude);
+}
+
+static void checkParse(const std::string& text) {
+    ++g_parsed;
+    Fixed got = 0;
+    double value;
+    // Only what overflows or underflows a double may be turned away
+    if (!parseFixed(text.c_str(), text.size(), got)) {
+        if (parseValue(text.c_str(), text.size(), value))
+            fail("parseFixed rejected \"" + text + "\"");
+        return;
+    }
+    const Fixed want = refParse(text);
+    if (got != want)
+        fail("parseFixed(\"" + text + "\") = " + fixedText(got) + ", want " + fixedText(want));
+    if (got != FIXED_MAX && got != -FIXED_MAX) {
+        char buf[FIXED_TEXT_MAX];
+        const std::string shown(buf, formatFixed(got, buf));
+        Fixed again = 0;
+        if (shown != refFormat(got) || !parseFixed(shown.c_str(), shown.size(), again) || again != got)
+            fail("formatFixed(" + fixedText(got) + ") = \"" + shown + "\", want \"" + refFormat(got) + "\"");
+    }
+}
+
+// Anything parseValue rejects for its syntax, parseFixed must reject too
+static void checkMalformed(std::string text) {
+    const size_t at = static_cast<size_t>(nextRandom() % (text.size() + 1));
+    static const char JUNK[] = " .eE+-x0";
+    if (nextRandom() % 2 && at < text.size())
+        text.erase(at, 1);
+    else
+        text.insert(at, 1, JUNK[nextRandom() % (sizeof(JUNK) - 1)]);
+    Fixed fixed;
+    double value;
+    const bool fixedOk = parseFixed(text.c_str(), text.size(), fixed);
+    const bool valueOk = parseValue(text.c_str(), text.size(), value);
+    if (fixedOk != valueOk)
+        fail("\"" + text + "\": parseFixed " + (fixedOk ? "accepts" : "rejects") + ", parseValue does not");
+}
+
+static void checkProduct(Fixed a, Fixed b) {
+    ++g_products;
+    Fixed got = 0;
+    Fixed want = 0;
+    const bool ok = multiplyFixed(a, b, got);
+    const bool wantOk = refMultiply(a, b, want);
+    if (ok != wantOk || (ok && got != want))
+        fail("multiplyFixed(" + fixedText(a) + ", " + fixedText(b) + ") = " + (ok ? fixedText(got) : "overflow")
+            + ", want " + (wantOk ? fixedText(want) : "overflow"));
+}
+
+static std::string reply(const BitcoinExchange& exchange, const std::string& line) {
+    const LineSlice slice = { line.data(), line.size() };
+    std::vector<char> response;
+    exchange.answerQuery(slice, '|', response);
+    return std::string(response.begin(), response.end());
+}
+
+// The amount must be turned away with the message double mode gives, or
+// with want if given. Amounts a double rounds to exactly 1000 are left
+// out: only the digits can tell whether they are too large.
+static void checkQuery(const BitcoinExchange& exact, const BitcoinExchange& fixed, const std::string& amount,
+    const char* want = NULL) {
+    double value;
+    if (!want && parseValue(amount.c_str(), amount.size(), value) && value == 1000)
+        return;
+    ++g_queries;
+    const std::string line = "2012-01-02 | " + amount;
+    const std::string expected = want ? std::string(want) + "\n" : reply(exact, line);
+    const std::string got = reply(fixed, line);
+    const bool expectedError = expected.compare(0, 6, "Error:") == 0;
+    const bool gotError = got.compare(0, 6, "Error:") == 0;
+    if (expectedError != gotError || (expectedError && got != expected))
+        fail("--fixed \"" + line + "\" gave \"" + got.substr(0, got.size() - 1) + "\", want \""
+            + expected.substr(0, expected.size() - 1) + "\"");
+}
+
+// Rates written with at most 15 significant digits come back exactly
+static void checkRates() {
+    RateTable table;
+    std::vector<std::string> texts;
+    for (int i = 0; i < 2000; ++i) {
+        const size_t whole = 1 + static_cast<size_t>(nextRandom() % 11);
+        const size_t decimals = static_cast<size_t>(nextRandom() % (15 - whole < 8 ? 15 - whole + 1 : 9));
+        std::string text = stripZeros(randomDigits(whole));
+        if (decimals)
+            text += "." + randomDigits(decimals);
+        texts.push_back(text);
+        table.insert(i, std::strtod(text.c_str(), NULL));
+    }
+    table.freeze();
+    table.buildFixed();
+    for (size_t i = 0; i < texts.size(); ++i) {
+        ++g_rates;
+        Fixed want = 0;
+        parseFixed(texts[i].c_str(), texts[i].size(), want);
+        if (table.fixedAt(i) != want)
+            fail("buildFixed(" + texts[i] + ") = " + fixedText(table.fixedAt(i)) + ", want " + fixedText(want));
+    }
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0x6a09e667u) << 32) | 0xf3bcc908u);
+    static const char* const CASES[] = {
+        "0", "-0", "1", "0.5", "0.000000005", "0.000000015", "0.000000025", "0.0000000250001",
+        "-0.000000005", "1.999999995", "1000", "1000.000000004", "1e3", "1E-8", "5e-9", "15e-9",
+        "92233720368.54775806", "92233720368.54775807", "92233720368.547758065", "1e11", "1e300",
+        "-1e300", "0e999", "0.00000000000000001", "12345678901234567.12345678901234567"
+    };
+    for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); ++i)
+        checkParse(CASES[i]);
+    static const char* const OUT_OF_RANGE[] = { "1e999", "-1e999", "1e400", "1e-400", "-1e-400", "1.8e308", "1e-320" };
+    for (size_t i = 0; i < sizeof(OUT_OF_RANGE) / sizeof(OUT_OF_RANGE[0]); ++i) {
+        Fixed ignored;
+        if (parseFixed(OUT_OF_RANGE[i], std::strlen(OUT_OF_RANGE[i]), ignored))
+            fail("parseFixed accepted \"" + std::string(OUT_OF_RANGE[i]) + "\"");
+    }
+    BitcoinExchange exact("data.csv", ',');
+    BitcoinExchange fixed(exact);
+    fixed.setFixedPoint(true);
+    checkQuery(exact, fixed, "1000.000000001", "Error: too large a number.");
+    checkQuery(exact, fixed, "-0.000000001", "Error: not a positive number.");
+    checkQuery(exact, fixed, "1e400", "Error: bad input => 2012-01-02 | 1e400");
+    checkQuery(exact, fixed, "1e-400", "Error: bad input => 2012-01-02 | 1e-400");
+    for (int i = 0; i < 300000; ++i) {
+        const std::string text = randomValueText();
+        checkParse(text);
+        checkMalformed(text);
+        if (i % 10 == 0)
+            checkQuery(exact, fixed, text);
+    }
+    static const Fixed EDGES[] = { 0, 1, -1, 5, 50000000, 150000000, FIXED_ONE, 1000 * FIXED_ONE,
+        FIXED_MAX, -FIXED_MAX, FIXED_MAX - 1, 3037000499, 303700049977 };
+    const size_t edges = sizeof(EDGES) / sizeof(EDGES[0]);
+    for (size_t i = 0; i < edges; ++i)
+        for (size_t j = 0; j < edges; ++j)
+            checkProduct(EDGES[i], EDGES[j]);
+    for (int i = 0; i < 300000; ++i)
+        checkProduct(randomFixed(), randomFixed());
+    checkRates();
+    std::cout << "fixed_test: " << g_parsed << " values, " << g_products << " products, " << g_rates
+        << " rates, " << g_queries << " queries, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,91 @@
+// Differential test: formatDouble (OutputBuffer) against the
+// "std::ostream << double" output it replaces, byte for byte.
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include "OutputBuffer.hpp"
+#include "TestSupport.hpp"
+
+static double randomUnit() {
+    return static_cast<double>(nextRandom() >> 11) / 9007199254740992.0;
+}
+
+static double fromBits(uint64_t bits) {
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static uint64_t toBits(double d) {
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+static long g_checked = 0;
+
+static void check(double value) {
+    std::ostringstream oss;
+    oss << value;
+    char buf[DOUBLE_TEXT_MAX];
+    const size_t n = formatDouble(value, buf);
+    const std::string got(buf, n);
+    ++g_checked;
+    if (got != oss.str() && g_failures++ < 20)
+        std::cerr << "format mismatch: ostream=\"" << oss.str() << "\" formatDouble=\"" << got << "\"" << std::endl;
+}
+
+// value and its immediate neighbours in both directions
+static void checkAround(double value) {
+    const uint64_t bits = toBits(value);
+    for (int d = -3; d <= 3; ++d)
+        check(fromBits(bits + static_cast<uint64_t>(static_cast<int64_t>(d))));
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0x139408dcu) << 32) | 0xbbf7a44u);
+    static const double fixedValues[] = {
+        0.0, 1.0, 0.3, 0.36, 7.1, 999999.0, 999999.5, 999999.4999, 123456.5, 123457.5,
+        0.0001, 0.00009999995, 0.000123455, 1e-5, 1e6, 1e15, 1e300, 4.9e-324, 0.1, 0.2,
+        2.675, 1.0000005, 9.9999995, 99999.95, 47115.93 * 3, 1000 * 1e5
+    };
+    for (size_t i = 0; i < sizeof(fixedValues) / sizeof(fixedValues[0]); ++i) {
+        checkAround(fixedValues[i]);
+        checkAround(-fixedValues[i]);
+    }
+    check(fromBits(static_cast<uint64_t>(1) << 63)); // -0.0
+    // Powers of ten and the half-way points where 6 digits round up
+    double p = 1e-6;
+    for (int i = 0; i < 14; ++i, p *= 10) {
+        checkAround(p);
+        checkAround(p * 0.9999995);
+        checkAround(p * 9.999995);
+    }
+    // Quantity x rate products like the ones btc prints
+    for (int i = 0; i < 1000000; ++i) {
+        const double value = static_cast<double>(nextRandom() % 100000) / 100.0;
+        const double rate = static_cast<double>(nextRandom() % 10000000) / 100.0;
+        check(value);
+        check(value * rate);
+    }
+    // Uniform over magnitudes, and raw bit patterns
+    for (int i = 0; i < 1000000; ++i) {
+        double scale = 1e-8;
+        for (int k = static_cast<int>(nextRandom() % 16); k > 0; --k)
+            scale *= 10;
+        check(randomUnit() * scale);
+        check(fromBits(nextRandom()));
+    }
+    // Exact ties at every decimal position (x.5 after the 6th digit)
+    for (int i = 0; i < 200000; ++i) {
+        const double tie = (static_cast<double>(100000 + nextRandom() % 900000) + 0.5);
+        check(tie);
+        check(tie / 1024);
+    }
+
+    std::cout << "format_test: " << g_checked << " values, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,158 @@
+// Synthetic data for the btc benchmark.
+//
+//   btc_gen db <rows> <out.csv> [seed]
+//       A "date,exchange_rate" database. Dates are spread evenly over the
+//       accepted range (2009-01-01 .. 2100-12-31); more rows than days
+//       repeat dates, which btc resolves last-wins.
+//
+//   btc_gen queries <lines> <out.txt> [order] [error_ratio] [values] [seed]
+//       A "date | value" input file.
+//       order:       sorted | random | mostly (sorted, 1% out of place)
+//       error_ratio: share of malformed lines, 0.0 .. 1.0
+//       values:      uniform (0..1000) | small (integers 1..10)
+//                    | wide (varied digits, exponents)
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "RateTable.hpp"
+
+static uint64_t g_state = 0x9e3779b9u;
+
+static uint64_t nextRandom() {
+    g_state ^= g_state << 13;
+    g_state ^= g_state >> 7;
+    g_state ^= g_state << 17;
+    return g_state;
+}
+
+static double randomUnit() {
+    return static_cast<double>(nextRandom() >> 11) / 9007199254740992.0;
+}
+
+// Inverse of RateTable::dayNumber
+static void civilFromDay(int z, int& y, int& m, int& d) {
+    z += 719468;
+    const int era = (z >= 0 ? z : z - 146096) / 146097;
+    const int doe = z - era * 146097;
+    const int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const int mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = yoe + era * 400 + (m <= 2);
+}
+
+static void formatDate(int day, char* buf) {
+    int y, m, d;
+    civilFromDay(day, y, m, d);
+    std::sprintf(buf, "%04d-%02d-%02d", y, m, d);
+}
+
+static const int FIRST_DAY = RateTable::dayNumber(2009, 1, 1);
+static const int LAST_DAY = RateTable::dayNumber(2100, 12, 31);
+
+static int generateDb(long rows, const char* path) {
+    std::FILE* f = std::fopen(path, "w");
+    if (!f)
+        return EXIT_FAILURE;
+    std::fprintf(f, "date,exchange_rate\n");
+    const long days = LAST_DAY - FIRST_DAY + 1;
+    double rate = 0.1;
+    char date[16];
+    for (long i = 0; i < rows; ++i) {
+        const long slot = (i % days) * days / (rows < days ? rows : days) % days;
+        formatDate(FIRST_DAY + static_cast<int>(slot), date);
+        rate *= 1.0 + (randomUnit() - 0.48) * 0.05;
+        std::fprintf(f, "%s,%.6g\n", date, rate);
+    }
+    return std::fclose(f) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void writeValue(std::FILE* f, const std::string& kind) {
+    if (kind == "small")
+        std::fprintf(f, "%d", static_cast<int>(1 + nextRandom() % 10));
+    else if (kind == "wide") {
+        switch (nextRandom() % 3) {
+            case 0: std::fprintf(f, "%.*f", static_cast<int>(nextRandom() % 17), randomUnit() * 1000); break;
+            case 1: std::fprintf(f, "%de%d", static_cast<int>(nextRandom() % 100), -static_cast<int>(nextRandom() % 4)); break;
+            default: std::fprintf(f, "%lu", static_cast<unsigned long>(nextRandom() % 1000)); break;
+        }
+    } else
+        std::fprintf(f, "%.2f", randomUnit() * 1000);
+}
+
+// One malformed line, cycling through the error categories btc reports
+static void writeError(std::FILE* f, const char* date) {
+    switch (nextRandom() % 5) {
+        case 0: std::fprintf(f, "%s | -%d\n", date, static_cast<int>(1 + nextRandom() % 100)); break;
+        case 1: std::fprintf(f, "%s | %d\n", date, static_cast<int>(1001 + nextRandom() % 100000)); break;
+        case 2: std::fprintf(f, "%s\n", date); break;
+        case 3: std::fprintf(f, "2008-12-31 | 1\n"); break;
+        default: std::fprintf(f, "%.4s-13-40 | 1\n", date); break;
+    }
+}
+
+static int generateQueries(long lines, const char* path, const std::string& order, double errorRatio, const std::string& values) {
+    std::vector<int> days(static_cast<size_t>(lines));
+    for (size_t i = 0; i < days.size(); ++i)
+        days[i] = FIRST_DAY + static_cast<int>(nextRandom() % static_cast<uint64_t>(LAST_DAY - FIRST_DAY + 1));
+    if (order != "random") {
+        std::sort(days.begin(), days.end());
+        if (order == "mostly") {
+            for (size_t k = 0; k < days.size() / 100; ++k)
+                std::swap(days[nextRandom() % days.size()], days[nextRandom() % days.size()]);
+        }
+    }
+    std::FILE* f = std::fopen(path, "w");
+    if (!f)
+        return EXIT_FAILURE;
+    std::fprintf(f, "date | value\n");
+    char date[16];
+    for (size_t i = 0; i < days.size(); ++i) {
+        formatDate(days[i], date);
+        if (randomUnit() < errorRatio) {
+            writeError(f, date);
+            continue;
+        }
+        std::fprintf(f, "%s | ", date);
+        writeValue(f, values);
+        std::fputc('\n', f);
+    }
+    return std::fclose(f) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int usage() {
+    std::fprintf(stderr, "Usage: ./btc_gen db <rows> <out.csv> [seed]\n");
+    std::fprintf(stderr, "       ./btc_gen queries <lines> <out.txt> [sorted|random|mostly] [error_ratio] [uniform|small|wide] [seed]\n");
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4)
+        return usage();
+    const long count = std::atol(argv[2]);
+    if (count < 0)
+        return usage();
+    if (std::strcmp(argv[1], "db") == 0 && argc <= 5) {
+        if (argc == 5)
+            g_state += static_cast<uint64_t>(std::atol(argv[4]));
+        return generateDb(count, argv[3]);
+    }
+    if (std::strcmp(argv[1], "queries") == 0 && argc <= 8) {
+        const std::string order = argc > 4 ? argv[4] : "sorted";
+        const double errorRatio = argc > 5 ? std::atof(argv[5]) : 0.0;
+        const std::string values = argc > 6 ? argv[6] : "uniform";
+        if (argc > 7)
+            g_state += static_cast<uint64_t>(std::atol(argv[7]));
+        if (order != "sorted" && order != "random" && order != "mostly")
+            return usage();
+        if (values != "uniform" && values != "small" && values != "wide")
+            return usage();
+        return generateQueries(count, argv[3], order, errorRatio, values);
+    }
+    return usage();
+}
@@ -0,0 +1,34 @@
+#ifndef JSONTEXT_HPP
+#define JSONTEXT_HPP
+
+#include <cstdio>
+#include <string>
+
+// text as a JSON string literal, quotes included, for the file names and
+// asset names that end up in the stats and benchmark reports. '"', '\\'
+// and control bytes are escaped; other bytes, UTF-8 included, pass as is.
+inline std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (size_t i = 0; i < text.size(); ++i) {
+        const unsigned char c = static_cast<unsigned char>(text[i]);
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20 || c == 0x7f) {
+                    char escape[8];
+                    std::sprintf(escape, "\\u%04x", c);
+                    out += escape;
+                } else {
+                    out += static_cast<char>(c);
+                }
+                break;
+        }
+    }
+    return out + "\"";
+}
+
+#endif // JSONTEXT_HPP
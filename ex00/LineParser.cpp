@@ -0,0 +1,193 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+#include "LineParser.hpp"
+#include "RateTable.hpp"
+
+bool isLeap(int year) {
+    // 4で割り切れ、かつ100で割り切れない年、または400で割り切れる年
+    return (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+}
+
+static inline bool isDigit(char c) {
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+// Calendar checks of a date whose digits are already known to be digits
+static bool checkedDay(int y, int m, int d, int& day) {
+    // 年と月の基本的な範囲チェック
+    if (y < MIN_YEAR || y > MAX_YEAR) return false;
+    if (m < 1 || m > 12) return false;
+
+    // 日の範囲チェック（2月はうるう年を考慮）
+    static const int DAYS_IN_MONTH[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    const int daysInMonth = (m == 2 && isLeap(y)) ? 29 : DAYS_IN_MONTH[m - 1];
+    if (d < 1 || d > daysInMonth) return false;
+
+    day = RateTable::dayNumber(y, m, d);
+    return true;
+}
+
+bool parseDate(const char* str, size_t len, int& day) {
+    if (len != 10) return false;
+    for (int i = 0; i < 10; ++i) {
+        if (i == 4 || i == 7) {
+            if (str[i] != '-') return false;
+        } else {
+            if (!isDigit(str[i])) return false;
+        }
+    }
+    const int y = (str[0] - '0') * 1000 + (str[1] - '0') * 100 + (str[2] - '0') * 10 + (str[3] - '0');
+    const int m = (str[5] - '0') * 10 + (str[6] - '0');
+    const int d = (str[8] - '0') * 10 + (str[9] - '0');
+    return checkedDay(y, m, d, day);
+}
+
+PrefixScan scanDatePrefixScalar(const char* str, size_t len, char delim, int& day) {
+    if (len < DATE_PREFIX_LEN || str[10] != ' ' || str[11] != delim || str[12] != ' ')
+        return PREFIX_OTHER;
+    for (int i = 0; i < 10; ++i) {
+        if (i == 4 || i == 7 ? str[i] != '-' : !isDigit(str[i]))
+            return PREFIX_OTHER;
+    }
+    const int y = (str[0] - '0') * 1000 + (str[1] - '0') * 100 + (str[2] - '0') * 10 + (str[3] - '0');
+    const int m = (str[5] - '0') * 10 + (str[6] - '0');
+    const int d = (str[8] - '0') * 10 + (str[9] - '0');
+    return checkedDay(y, m, d, day) ? PREFIX_DATE : PREFIX_BAD_DATE;
+}
+
+#if defined(__SSE2__)
+
+bool hasVectorDateScan() {
+    return true;
+}
+
+// One 16-byte load covers the prefix. It never reads past the line: a
+// line of 13 to 15 bytes ("2011-01-03 | 3" is 14) is copied into a zeroed
+// local block first, and the bytes past the prefix are masked off.
+PrefixScan scanDatePrefix(const char* str, size_t len, char delim, int& day) {
+    if (len < DATE_PREFIX_LEN)
+        return PREFIX_OTHER;
+    char block[16] = {0};
+    if (len < sizeof(block)) {
+        std::memcpy(block, str, len);
+        str = block;
+    }
+    // Bit i of a movemask is byte i: digits at 0-3, 5-6, 8-9, then the
+    // literal "-" "-" " " delim " " at 4, 7, 10, 11, 12
+    const int DIGITS = 0x030f | 0x0060;
+    const int LITERALS = 0x1c90;
+    const __m128i text = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str));
+    const __m128i literal = _mm_setr_epi8('\0', '\0', '\0', '\0', '-', '\0', '\0', '-', '\0', '\0',
+        ' ', delim, ' ', '\0', '\0', '\0');
+    const __m128i digits = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+    // A digit is 0..9 after the subtraction: nothing left once 9 is taken off
+    const __m128i isDigitByte = _mm_cmpeq_epi8(_mm_subs_epu8(digits, _mm_set1_epi8(9)), _mm_setzero_si128());
+    if ((_mm_movemask_epi8(isDigitByte) & DIGITS) != DIGITS
+        || (_mm_movemask_epi8(_mm_cmpeq_epi8(text, literal)) & LITERALS) != LITERALS)
+        return PREFIX_OTHER;
+    // Widen the digit values to 16 bits and weight them by place value:
+    // the pairwise sums give (Y0*1000 + Y1*100, Y2*10 + Y3, M0*10, M1) and
+    // (D0*10 + D1, ...); the dash bytes get weight 0
+    const __m128i low = _mm_unpacklo_epi8(digits, _mm_setzero_si128());
+    const __m128i high = _mm_unpackhi_epi8(digits, _mm_setzero_si128());
+    const __m128i sums = _mm_madd_epi16(low, _mm_setr_epi16(1000, 100, 10, 1, 0, 10, 1, 0));
+    const __m128i daySum = _mm_madd_epi16(high, _mm_setr_epi16(10, 1, 0, 0, 0, 0, 0, 0));
+    int32_t parts[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(parts), sums);
+    const int y = parts[0] + parts[1];
+    const int m = parts[2] + parts[3];
+    const int d = _mm_cvtsi128_si32(daySum);
+    return checkedDay(y, m, d, day) ? PREFIX_DATE : PREFIX_BAD_DATE;
+}
+
+#else
+
+bool hasVectorDateScan() {
+    return false;
+}
+
+PrefixScan scanDatePrefix(const char* str, size_t len, char delim, int& day) {
+    return scanDatePrefixScalar(str, len, delim, day);
+}
+
+#endif
+
+// Powers of ten that are exactly representable as a double
+static const double EXACT_POW10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Longest accepted spelling: sign, 17 + '.' + 17 digits, 'e', sign, 3 digits
+static const size_t MAX_VALUE_LEN = 1 + 17 + 1 + 17 + 1 + 1 + 3;
+
+bool parseValue(const char* str, size_t len, double& value) {
+    // 正規表現 [-+]?\d{1,17}(\.\d{1,17})?([eE][-+]?\d{1,3})? に沿った手動チェック
+    const uint64_t MANTISSA_LIMIT = static_cast<uint64_t>(1) << 53;
+    size_t i = 0;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    bool exact = true; // mantissa still fits in 53 bits
+    if (len == 0 || len > MAX_VALUE_LEN) return false;
+    if (str[0] == '-' || str[0] == '+') {
+        negative = (str[0] == '-');
+        i = 1;
+    }
+    // 整数部（1～17桁）
+    size_t start = i;
+    for (; i < len && isDigit(str[i]); ++i) {
+        mantissa = mantissa * 10 + static_cast<unsigned>(str[i] - '0');
+        exact = exact && mantissa <= MANTISSA_LIMIT;
+    }
+    if (i - start < 1 || i - start > 17) return false;
+    // 小数部（任意、1～17桁）
+    int exponent = 0;
+    if (i < len && str[i] == '.') {
+        start = ++i;
+        for (; i < len && isDigit(str[i]); ++i) {
+            mantissa = mantissa * 10 + static_cast<unsigned>(str[i] - '0');
+            exact = exact && mantissa <= MANTISSA_LIMIT;
+        }
+        if (i - start < 1 || i - start > 17) return false;
+        exponent = -static_cast<int>(i - start);
+    }
+    // 指数部（任意、e/E[-+]?1～3桁）
+    if (i < len && (str[i] == 'e' || str[i] == 'E')) {
+        ++i;
+        bool expNegative = false;
+        if (i < len && (str[i] == '-' || str[i] == '+')) {
+            expNegative = (str[i] == '-');
+            ++i;
+        }
+        start = i;
+        int e = 0;
+        for (; i < len && isDigit(str[i]); ++i) {
+            if (i - start < 3)
+                e = e * 10 + (str[i] - '0');
+        }
+        if (i - start < 1 || i - start > 3) return false;
+        exponent += expNegative ? -e : e;
+    }
+    if (i != len) return false;
+    // 仮数が53bitに収まり10の累乗も正確なら、一回の乗除算で strtod と同じ値になる
+    // (mantissa overflowing uint64_t above is harmless: exact is already false)
+    if (exact && exponent >= -22 && exponent <= 22) {
+        double v = static_cast<double>(mantissa);
+        v = exponent < 0 ? v / EXACT_POW10[-exponent] : v * EXACT_POW10[exponent];
+        value = negative ? -v : v;
+        return true;
+    }
+    // それ以外は strtod に任せ、オーバーフロー・アンダーフローを検出
+    char buf[MAX_VALUE_LEN + 1];
+    std::memcpy(buf, str, len);
+    buf[len] = '\0';
+    errno = 0;
+    value = std::strtod(buf, NULL);
+    if (errno == ERANGE) return false;
+    return true;
+}
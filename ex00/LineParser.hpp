@@ -0,0 +1,55 @@
+#ifndef LINEPARSER_HPP
+#define LINEPARSER_HPP
+
+#include <cstddef>
+#include "LineReader.hpp"
+#include "FixedPoint.hpp"
+
+// A validated "date | value [| asset]" line
+struct ParsedLine {
+    LineSlice date;
+    int day;
+    double value;
+    Fixed amount;   // the value, in fixed-point mode instead
+    int dropped;    // sign of what rounding amount took off the value
+    LineSlice asset;    // the third field, empty when there is none
+    size_t column;      // the rate column the line is answered from
+};
+
+// Single-pass validators for the two fields of a btc line.
+// Each one checks the text and produces the converted result in the same
+// scan, without streams, locales or heap allocation.
+
+// Range of years a date may have
+static const int MIN_YEAR = 2009;
+static const int MAX_YEAR = 2100;
+
+// "YYYY-MM-DD" with a year in [MIN_YEAR, MAX_YEAR] and a real calendar day.
+// On success stores the RateTable day number in day.
+bool parseDate(const char* str, size_t len, int& day);
+
+// [-+]?\d{1,17}(\.\d{1,17})?([eE][-+]?\d{1,3})? whose value is finite and
+// does not underflow, exactly as strtod() would convert it.
+bool parseValue(const char* str, size_t len, double& value);
+
+// Fast path for the usual input shape, "YYYY-MM-DD <delim> <value>":
+// the 13-byte prefix up to the value is checked, and the date converted,
+// in a few SSE2 operations where available. PREFIX_OTHER means the line
+// has some other shape and needs the general split; otherwise the date
+// field is exactly the first 10 bytes, valid (PREFIX_DATE, day set) or
+// not (PREFIX_BAD_DATE), and the value field starts after byte 12.
+// delim must not be a digit, '-', ' ' or '\t'.
+enum PrefixScan {
+    PREFIX_OTHER,
+    PREFIX_BAD_DATE,
+    PREFIX_DATE
+};
+static const size_t DATE_PREFIX_LEN = 13;
+
+PrefixScan scanDatePrefix(const char* str, size_t len, char delim, int& day);
+PrefixScan scanDatePrefixScalar(const char* str, size_t len, char delim, int& day);
+bool hasVectorDateScan();
+
+bool isLeap(int year);
+
+#endif // LINEPARSER_HPP
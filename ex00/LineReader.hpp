@@ -0,0 +1,43 @@
+#ifndef LINEREADER_HPP
+#define LINEREADER_HPP
+
+#include <cstddef>
+#include <cstring>
+
+// A line as a pointer/length pair into a buffer owned by someone else
+struct LineSlice {
+    const char* ptr;
+    size_t len;
+};
+
+// Splits a buffer into '\n'-terminated lines without copying them.
+// Like std::getline, a final line without a newline is still returned
+// and a trailing newline does not produce an extra empty line.
+class LineReader {
+public:
+    LineReader(const char* data, size_t size) : _pos(data), _end(data + size) {}
+
+    bool next(LineSlice& line) {
+        if (_pos >= _end)
+            return false;
+        const char* nl = static_cast<const char*>(std::memchr(_pos, '\n', static_cast<size_t>(_end - _pos)));
+        line.ptr = _pos;
+        if (nl) {
+            line.len = static_cast<size_t>(nl - _pos);
+            _pos = nl + 1;
+        } else {
+            line.len = static_cast<size_t>(_end - _pos);
+            _pos = _end;
+        }
+        return true;
+    }
+
+    // The part of the buffer not handed out yet
+    const char* position() const { return _pos; }
+    const char* end() const { return _end; }
+private:
+    const char* _pos;
+    const char* _end;
+};
+
+#endif // LINEREADER_HPP
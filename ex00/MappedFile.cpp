@@ -0,0 +1,71 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include "MappedFile.hpp"
+
+static const size_t READ_CHUNK = 1 << 20;
+
+MappedFile::MappedFile(const std::string& filename) : _map(NULL), _size(0), _open(false) {
+    const bool isStdin = (filename == "-");
+    int fd = isStdin ? STDIN_FILENO : open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            _map = p;
+            _size = static_cast<size_t>(st.st_size);
+            _open = true;
+        }
+    }
+    if (!_open) {
+        readAll(fd);
+        _open = true;
+    }
+    if (!isStdin)
+        close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (_map)
+        munmap(_map, _size);
+}
+
+// A read error ends the input early, the same way it ends a getline() loop
+void MappedFile::readAll(int fd) {
+    size_t used = 0;
+    for (;;) {
+        if (_buffer.size() - used < READ_CHUNK)
+            _buffer.resize(used + READ_CHUNK);
+        ssize_t n = read(fd, &_buffer[used], _buffer.size() - used);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0)
+            break;
+        used += static_cast<size_t>(n);
+    }
+    _buffer.resize(used);
+    _size = used;
+}
+
+bool MappedFile::isOpen() const {
+    return _open;
+}
+
+const char* MappedFile::data() const {
+    if (_map)
+        return static_cast<const char*>(_map);
+    return _buffer.empty() ? NULL : &_buffer[0];
+}
+
+size_t MappedFile::size() const {
+    return _size;
+}
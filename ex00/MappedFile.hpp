@@ -0,0 +1,29 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file.
+// Regular files are mmap'ed so their bytes are never copied; pipes, ttys and
+// stdin ("-") cannot be mapped and are slurped with large read() calls instead.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+    bool isOpen() const;
+    const char* data() const;
+    size_t size() const;
+private:
+    void readAll(int fd);
+    MappedFile();
+    MappedFile(const MappedFile& other);
+    MappedFile& operator=(const MappedFile& other);
+    void* _map;
+    size_t _size;
+    std::vector<char> _buffer;
+    bool _open;
+};
+
+#endif // MAPPEDFILE_HPP
@@ -0,0 +1,152 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include "OutputBuffer.hpp"
+
+static void writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+}
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity)
+    : _fd(fd), _buf(capacity < DOUBLE_TEXT_MAX ? DOUBLE_TEXT_MAX : capacity), _used(0), _tied(NULL) {}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+// True when both descriptors write to the same file, pipe or terminal
+bool OutputBuffer::sameTarget(int fd1, int fd2) {
+    struct stat st1;
+    struct stat st2;
+    if (fstat(fd1, &st1) != 0 || fstat(fd2, &st2) != 0)
+        return true;
+    return st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+}
+
+void OutputBuffer::tie(OutputBuffer* other) {
+    _tied = other;
+}
+
+void OutputBuffer::flush() {
+    writeAll(_fd, &_buf[0], _used);
+    _used = 0;
+}
+
+void OutputBuffer::reserve(size_t len) {
+    if (_tied && _tied->_used)
+        _tied->flush();
+    if (_buf.size() - _used < len)
+        flush();
+}
+
+void OutputBuffer::write(const char* data, size_t len) {
+    reserve(len);
+    if (len > _buf.size()) {
+        writeAll(_fd, data, len);
+        return;
+    }
+    std::memcpy(&_buf[_used], data, len);
+    _used += len;
+}
+
+void OutputBuffer::put(char c) {
+    reserve(1);
+    _buf[_used++] = c;
+}
+
+void OutputBuffer::putDouble(double value) {
+    reserve(DOUBLE_TEXT_MAX);
+    _used += formatDouble(value, &_buf[_used]);
+}
+
+// Sign bit test that also sees -0.0 (std::signbit is C++11)
+static bool isNegative(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits >> 63) != 0;
+}
+
+static const double POW10[10] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+static const double DECADE[10] = { 1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2, 1e3, 1e4, 1e5 };
+
+// %g with precision 6 prints 6 significant digits, in fixed notation when
+// the decimal exponent X is in [-4, 6) and with trailing zeros removed.
+// For that range the digits are computed as round(|v| * 10^(5-X)), one
+// exactly-scaled multiply. Inputs where that product could round
+// differently from printf's exact decimal conversion (a near tie, or a
+// value next to a power of ten) and everything outside the range are
+// passed to snprintf, which is the reference anyway.
+size_t formatDouble(double value, char* out) {
+    const double a = std::fabs(value);
+    if (a >= 1e-4 && a < 999999.5) {
+        int x = 0;
+        while (x < 9 && a >= DECADE[x + 1])
+            ++x;
+        const double lo = DECADE[x];
+        if (a - lo > lo * 1e-12 && (x == 9 || DECADE[x + 1] - a > lo * 1e-11)) {
+            const double scaled = a * POW10[9 - x];
+            const double whole = std::floor(scaled);
+            const double frac = scaled - whole;
+            if (std::fabs(frac - 0.5) > 1e-6) {
+                long digits = static_cast<long>(whole) + (frac > 0.5 ? 1 : 0);
+                if (digits < 1000000) {
+                    // digits holds exactly 6 significant digits; X = x - 4
+                    char tmp[6];
+                    for (int i = 5; i >= 0; --i) {
+                        tmp[i] = static_cast<char>('0' + digits % 10);
+                        digits /= 10;
+                    }
+                    int last = 5;
+                    while (last >= 0 && tmp[last] == '0')
+                        --last;
+                    const int exp10 = x - 4;
+                    size_t n = 0;
+                    if (isNegative(value))
+                        out[n++] = '-';
+                    if (exp10 >= 0) {
+                        for (int i = 0; i <= exp10; ++i)
+                            out[n++] = tmp[i];
+                        if (last > exp10) {
+                            out[n++] = '.';
+                            for (int i = exp10 + 1; i <= last; ++i)
+                                out[n++] = tmp[i];
+                        }
+                    } else {
+                        out[n++] = '0';
+                        out[n++] = '.';
+                        for (int i = exp10 + 1; i < 0; ++i)
+                            out[n++] = '0';
+                        for (int i = 0; i <= last; ++i)
+                            out[n++] = tmp[i];
+                    }
+                    return n;
+                }
+            }
+        }
+    }
+    if (value == 0) {
+        size_t n = 0;
+        if (isNegative(value))
+            out[n++] = '-';
+        out[n++] = '0';
+        return n;
+    }
+    char buf[DOUBLE_TEXT_MAX];
+    int len = std::snprintf(buf, sizeof(buf), "%g", value);
+    std::memcpy(out, buf, static_cast<size_t>(len));
+    return static_cast<size_t>(len);
+}
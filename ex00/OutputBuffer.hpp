@@ -0,0 +1,43 @@
+#ifndef OUTPUTBUFFER_HPP
+#define OUTPUTBUFFER_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Formats output into a large reusable buffer and hands it to write(2) in
+// big blocks instead of one flush per line.
+// Two buffers that end up in the same file (e.g. "btc in 2>&1 | less") can
+// be tied together: writing to one first flushes the other, so lines keep
+// the order they were produced in.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(int fd, size_t capacity = 1 << 20);
+    ~OutputBuffer();
+
+    static bool sameTarget(int fd1, int fd2);
+
+    void tie(OutputBuffer* other);
+    void write(const char* data, size_t len);
+    void put(char c);
+    void putDouble(double value);
+    void flush();
+private:
+    void reserve(size_t len);
+    OutputBuffer();
+    OutputBuffer(const OutputBuffer& other);
+    OutputBuffer& operator=(const OutputBuffer& other);
+    int _fd;
+    std::vector<char> _buf;
+    size_t _used;
+    OutputBuffer* _tied;
+};
+
+// Longest text formatDouble can produce, including a terminating NUL
+static const size_t DOUBLE_TEXT_MAX = 32;
+
+// Writes value exactly as "std::ostream << value" does with the default
+// flags and precision (printf "%g", 6 significant digits).
+// Returns the number of characters written to out (no NUL terminator).
+size_t formatDouble(double value, char* out);
+
+#endif // OUTPUTBUFFER_HPP
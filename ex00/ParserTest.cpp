@@ -0,0 +1,279 @@
+// Differential test: the single-pass parser (LineParser) against the
+// validators it replaced, which are kept below verbatim as the reference.
+// Every input must be accepted or rejected identically, and every accepted
+// value must convert to the same double, bit for bit.
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "LineParser.hpp"
+#include "RateTable.hpp"
+#include "TestSupport.hpp"
+
+// ---- Reference implementation (BitcoinExchange before the parser rewrite) ----
+
+static bool legacyIsValidDate(const std::string& date) {
+    if (date.size() != 10) return false;
+    for (int i = 0; i < 10; ++i) {
+        if (i == 4 || i == 7) {
+            if (date[i] != '-') return false;
+        } else {
+            if (!isdigit(date[i])) return false;
+        }
+    }
+    std::istringstream iss(date);
+    int year, month, day;
+    char d1, d2; // ハイフンを読み飛ばすためのダミー
+
+    // iss >> year >> d1 >> month >> d2 >> day のように一度に読み込む
+    // iss.fail()で、数値として読めなかった場合（例: "202a-10-10"）をチェック
+    if (!(iss >> year >> d1 >> month >> d2 >> day) || iss.fail()) {
+        return false;
+    }
+
+    // --- ③ 日付のルールと照合 ---
+    // 年と月の基本的な範囲チェック
+    if (year < 2009 || year > 2100) return false;
+    if (month < 1 || month > 12) return false;
+
+    // 日の範囲チェック
+    int daysInMonth;
+    switch (month) {
+        case 1: case 3: case 5: case 7: case 8: case 10: case 12:
+            daysInMonth = 31;
+            break;
+        case 4: case 6: case 9: case 11:
+            daysInMonth = 30;
+            break;
+        case 2: // 2月はうるう年を考慮
+            if (isLeap(year)) {
+                daysInMonth = 29;
+            } else {
+                daysInMonth = 28;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    if (day < 1 || day > daysInMonth) {
+        return false;
+    }
+
+    // 全てのチェックを通過
+    return true;
+}
+
+static bool legacyIsValidValue(const std::string& value) {
+    // 正規表現 [-+]?\d{1,17}(\.\d{1,17})?([eE][-+]?\d{1,3})? に沿った手動チェック
+    size_t i = 0;
+    if (value.empty()) return false;
+    if (value[0] == '-' || value[0] == '+') i = 1;
+    // 整数部（1～17桁）
+    size_t intStart = i;
+    while (i < value.size() && isdigit(value[i]) && (i - intStart) < 17) ++i;
+    if ((i - intStart) < 1 || (i - intStart) > 17) return false;
+    // 小数部（任意、1～17桁）
+    if (i < value.size() && value[i] == '.') {
+        ++i;
+        size_t fracStart = i;
+        while (i < value.size() && isdigit(value[i]) && (i - fracStart) < 17) ++i;
+        if ((i - fracStart) < 1 || (i - fracStart) > 17) return false;
+    }
+    // 指数部（任意、e/E[-+]?1～3桁）
+    if (i < value.size() && (value[i] == 'e' || value[i] == 'E')) {
+        ++i;
+        if (i < value.size() && (value[i] == '-' || value[i] == '+')) ++i;
+        size_t expStart = i;
+        while (i < value.size() && isdigit(value[i]) && (i - expStart) < 3) ++i;
+        if ((i - expStart) < 1 || (i - expStart) > 3) return false;
+    }
+    if (i != value.size()) return false;
+    // strtodで変換し、endが文字列終端であることを確認
+    char* end;
+    errno = 0;
+    std::strtod(value.c_str(), &end);
+    if (end != value.c_str() + value.size()) return false;
+    if (errno == ERANGE) return false; // オーバーフロー・アンダーフロー検出
+    return true;
+}
+
+// ---- Test driver ----
+
+static void checkDate(const std::string& s) {
+    int day = 0;
+    const bool got = parseDate(s.data(), s.size(), day);
+    const bool want = legacyIsValidDate(s);
+    if (got != want) {
+        if (g_failures++ < 20)
+            std::cerr << "date mismatch: \"" << s << "\" parser=" << got << " reference=" << want << std::endl;
+        return;
+    }
+    if (got) {
+        int y = std::atoi(s.substr(0, 4).c_str());
+        int m = std::atoi(s.substr(5, 2).c_str());
+        int d = std::atoi(s.substr(8, 2).c_str());
+        if (day != RateTable::dayNumber(y, m, d) && g_failures++ < 20)
+            std::cerr << "day number mismatch: \"" << s << "\"" << std::endl;
+    }
+}
+
+static void checkValue(const std::string& s) {
+    double got = 0;
+    const bool accepted = parseValue(s.data(), s.size(), got);
+    const bool want = legacyIsValidValue(s);
+    if (accepted != want) {
+        if (g_failures++ < 20)
+            std::cerr << "value mismatch: \"" << s << "\" parser=" << accepted << " reference=" << want << std::endl;
+        return;
+    }
+    if (accepted) {
+        double ref = std::strtod(s.c_str(), NULL);
+        if (std::memcmp(&got, &ref, sizeof(double)) != 0 && g_failures++ < 20)
+            std::cerr << "conversion mismatch: \"" << s << "\"" << std::endl;
+    }
+}
+
+// The vector prefix scan against the scalar one, and both against what the
+// general split would conclude: PREFIX_OTHER is always allowed to fall back,
+// but a definite answer must match parseDate on the first 10 bytes.
+static void checkPrefix(const char* line, size_t len) {
+    int vectorDay = -1;
+    int scalarDay = -1;
+    const PrefixScan got = scanDatePrefix(line, len, '|', vectorDay);
+    const PrefixScan want = scanDatePrefixScalar(line, len, '|', scalarDay);
+    bool ok = got == want && (got != PREFIX_DATE || vectorDay == scalarDay);
+    if (ok && want != PREFIX_OTHER) {
+        int day = -1;
+        const bool valid = parseDate(line, 10, day);
+        ok = valid == (want == PREFIX_DATE) && (!valid || day == scalarDay)
+            && line[10] == ' ' && line[11] == '|' && line[12] == ' ';
+    }
+    if (!ok && g_failures++ < 20)
+        std::cerr << "prefix mismatch: \"" << std::string(line, len) << "\" vector=" << got << " scalar=" << want << std::endl;
+}
+
+static std::string randomDigits(size_t n) {
+    std::string s;
+    for (size_t i = 0; i < n; ++i)
+        s += static_cast<char>('0' + nextRandom() % 10);
+    return s;
+}
+
+// A number that follows the grammar most of the time, with digit counts
+// and exponents pushed around the 17/17/3 limits and the strtod fast path
+static std::string randomNumber() {
+    std::string s;
+    switch (nextRandom() % 4) {
+        case 0: s += '-'; break;
+        case 1: s += '+'; break;
+        default: break;
+    }
+    s += randomDigits(nextRandom() % 19);
+    if (nextRandom() % 2) {
+        s += '.';
+        s += randomDigits(nextRandom() % 19);
+    }
+    if (nextRandom() % 3 == 0) {
+        s += (nextRandom() % 2) ? 'e' : 'E';
+        switch (nextRandom() % 3) {
+            case 0: s += '-'; break;
+            case 1: s += '+'; break;
+            default: break;
+        }
+        s += randomDigits(nextRandom() % 5);
+    }
+    return s;
+}
+
+static std::string randomNoise(const char* alphabet, size_t maxLen) {
+    const size_t n = nextRandom() % (maxLen + 1);
+    const size_t k = std::strlen(alphabet);
+    std::string s;
+    for (size_t i = 0; i < n; ++i)
+        s += alphabet[nextRandom() % k];
+    return s;
+}
+
+int main() {
+    seedRandom(12345);
+    long dates = 0;
+    long values = 0;
+    char buf[32];
+
+    // Every year/month/day combination around the accepted range
+    for (int y = 2000; y <= 2110; ++y) {
+        for (int m = 0; m <= 13; ++m) {
+            for (int d = 0; d <= 32; ++d) {
+                std::sprintf(buf, "%04d-%02d-%02d", y, m, d);
+                checkDate(buf);
+                ++dates;
+            }
+        }
+    }
+    // Mutated and random strings
+    for (int i = 0; i < 200000; ++i) {
+        std::sprintf(buf, "%04u-%02u-%02u", unsigned(2009 + nextRandom() % 92), unsigned(1 + nextRandom() % 12),
+                     unsigned(1 + nextRandom() % 31));
+        std::string s(buf);
+        s[nextRandom() % s.size()] = "0123456789-+ x/"[nextRandom() % 15];
+        checkDate(s);
+        checkDate(randomNoise("0123456789-", 12));
+        dates += 2;
+    }
+
+    // Prefix scans of "date | value" lines, some mutated, placed so that they
+    // end right before an unreadable page: a vector load must never cross it
+    long prefixes = 0;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    char* pages = static_cast<char*>(mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (pages == MAP_FAILED || mprotect(pages + page, page, PROT_NONE) != 0) {
+        std::cerr << "parser_test: cannot set up guard page" << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < 400000; ++i) {
+        std::sprintf(buf, "%04u-%02u-%02u | %u", unsigned(2000 + nextRandom() % 110), unsigned(nextRandom() % 14),
+                     unsigned(nextRandom() % 33), unsigned(nextRandom() % 2000));
+        std::string s(buf);
+        if (nextRandom() % 2)
+            s[nextRandom() % s.size()] = "0123456789-| x/\t"[nextRandom() % 16];
+        if (nextRandom() % 4 == 0)
+            s.resize(nextRandom() % (s.size() + 1));
+        char* at = pages + page - s.size() - (nextRandom() % 2 ? 0 : nextRandom() % 64);
+        std::memcpy(at, s.data(), s.size());
+        checkPrefix(at, s.size());
+        ++prefixes;
+    }
+    munmap(pages, page * 2);
+
+    static const char* fixedValues[] = {
+        "", "0", "-0", "+0", "1", "1.", ".5", "1e", "1e+", "1E-3", "1e400", "1e-400",
+        "1e308", "1.7976931348623157e308", "1.8e308", "4.9e-324", "2.2250738585072014e-308",
+        "12345678901234567", "123456789012345678", "0.00000000000000001", "0.000000000000000001",
+        "9007199254740992", "9007199254740993", "99999999999999999.99999999999999999e999",
+        "1e22", "1e23", "123456789012345e-22", "0x10", "inf", "nan", " 1", "1 ", "--1", NULL
+    };
+    for (int i = 0; fixedValues[i]; ++i) {
+        checkValue(fixedValues[i]);
+        ++values;
+    }
+    for (int i = 0; i < 1000000; ++i) {
+        checkValue(randomNumber());
+        ++values;
+    }
+    for (int i = 0; i < 200000; ++i) {
+        checkValue(randomNoise("0123456789.eE+-", 45));
+        ++values;
+    }
+
+    std::cout << "parser_test: " << dates << " dates, " << values << " values, " << prefixes << " prefixes ("
+              << (hasVectorDateScan() ? "SSE2" : "scalar") << "), " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,419 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "QueryServer.hpp"
+#include "BitcoinExchange.hpp"
+
+static const size_t READ_SIZE = 1 << 16;
+
+static volatile sig_atomic_t g_reloadRequested = 0;
+static volatile sig_atomic_t g_stopRequested = 0;
+// Self-pipe: the handlers also write a byte here, so a loop that checked
+// the flags and then waits in poll() is woken even when the signal came
+// between the check and the wait
+static int g_wakePipe[2] = { -1, -1 };
+
+static void wake() {
+    const int saved = errno;
+    const char byte = 0;
+    if (write(g_wakePipe[1], &byte, 1) < 0) {
+        // Full pipe: a wake-up is already pending
+    }
+    errno = saved;
+}
+
+extern "C" void onReloadSignal(int) {
+    g_reloadRequested = 1;
+    wake();
+}
+
+extern "C" void onStopSignal(int) {
+    g_stopRequested = 1;
+    wake();
+}
+
+static bool installSignals() {
+    if (g_wakePipe[0] < 0) {
+        if (pipe(g_wakePipe) != 0) {
+            std::cerr << "Error: could not create the signal pipe." << std::endl;
+            return false;
+        }
+        for (int i = 0; i < 2; ++i) {
+            fcntl(g_wakePipe[i], F_SETFL, fcntl(g_wakePipe[i], F_GETFL) | O_NONBLOCK);
+            fcntl(g_wakePipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = onReloadSignal;
+    sigaction(SIGHUP, &sa, NULL);
+    sa.sa_handler = onStopSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    return true;
+}
+
+// Blocks until fd is readable or a signal handler has run. Returns false
+// for a signal, after emptying the pipe: the caller looks at the flags
+// and comes back.
+static bool waitReadable(int fd) {
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = g_wakePipe[0];
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0)
+        return errno != EINTR;
+    if (fds[1].revents & POLLIN) {
+        char drain[64];
+        while (read(g_wakePipe[0], drain, sizeof(drain)) > 0)
+            ;
+        return false;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+QueryServer::QueryServer(const std::string& database, const std::string& snapshot, bool dense, bool fixedPoint, const std::string& asset)
+    : _database(database), _snapshot(snapshot), _dense(dense), _fixedPoint(fixedPoint), _asset(asset), _exchange(load()), _generation(1) {
+    pthread_mutex_init(&_lock, NULL);
+    pthread_mutex_init(&_connectionLock, NULL);
+}
+
+QueryServer::~QueryServer() {
+    pthread_mutex_destroy(&_connectionLock);
+    pthread_mutex_destroy(&_lock);
+}
+
+BitcoinExchange* QueryServer::load() const {
+    BitcoinExchange* exchange = new BitcoinExchange(_database, ',', _snapshot);
+    try {
+        exchange->setDenseLookup(_dense);
+        exchange->setFixedPoint(_fixedPoint);
+        exchange->setAsset(_asset);
+    } catch (...) {
+        delete exchange;
+        throw;
+    }
+    return exchange;
+}
+
+// Brings a thread's handle to the exchange in service up to date. Between
+// reloads this is one plain read of the generation: no lock, and no write
+// to a line other threads read. Only the first batch after a swap takes the
+// lock, to copy the new handle; a stale read just defers that by a batch.
+// An idle thread keeps the table it last used alive until its next batch.
+void QueryServer::current(SharedPtr<BitcoinExchange>& exchange, unsigned long& generation) {
+    if (_generation == generation)
+        return;
+    pthread_mutex_lock(&_lock);
+    exchange = _exchange;
+    generation = _generation;
+    pthread_mutex_unlock(&_lock);
+}
+
+// The replacement starts as a copy, sharing the current table, that
+// refresh() brings up to date: it parses only rows appended to the database
+// since it was loaded, into a table of its own. Queries keep running on the
+// current table meanwhile, and finish on it if they started before the swap.
+// A database that fails to load leaves the current table in service.
+void QueryServer::reloadIfRequested() {
+    if (!g_reloadRequested)
+        return;
+    g_reloadRequested = 0;
+    SharedPtr<BitcoinExchange> base;
+    unsigned long generation = 0;
+    current(base, generation);
+    SharedPtr<BitcoinExchange> fresh(new BitcoinExchange(*base));
+    try {
+        fresh->refresh();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return;
+    }
+    pthread_mutex_lock(&_lock);
+    _exchange.swap(fresh);
+    __sync_add_and_fetch(&_generation, 1);
+    pthread_mutex_unlock(&_lock);
+}
+
+// Reads whatever the client has sent, answers every complete line in it
+// with a single write, and keeps a trailing partial line for the next read.
+// A last line without a newline is answered at end of input. The thread
+// that handles reloads looks at the flag before every wait for input.
+void QueryServer::serveConnection(int in, int out, bool handlesReload) {
+    std::vector<char> pending;
+    std::vector<char> reply;
+    std::vector<char> chunk(READ_SIZE);
+    SharedPtr<BitcoinExchange> exchange;
+    unsigned long generation = 0;
+    bool eof = false;
+    while (!eof && !g_stopRequested) {
+        if (handlesReload) {
+            reloadIfRequested();
+            if (!waitReadable(in))
+                continue;
+        }
+        ssize_t n = read(in, &chunk[0], chunk.size());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0)
+            eof = true;
+        pending.insert(pending.end(), chunk.begin(), chunk.begin() + n);
+        if (pending.empty())
+            continue;
+        size_t used = pending.size();
+        if (!eof) {
+            while (used > 0 && pending[used - 1] != '\n')
+                --used;
+        }
+        if (used == 0)
+            continue;
+        reply.clear();
+        LineReader reader(&pending[0], used);
+        LineSlice line;
+        current(exchange, generation);
+        while (reader.next(line))
+            exchange->answerQuery(line, '|', reply);
+        pending.erase(pending.begin(), pending.begin() + used);
+        if (!reply.empty() && !writeAll(out, &reply[0], reply.size()))
+            break;
+    }
+}
+
+int QueryServer::serveStream(int in, int out) {
+    if (!installSignals())
+        return 1;
+    serveConnection(in, out, true);
+    return 0;
+}
+
+// One client thread. The accepting thread owns the fd: it closes it only
+// after the join, so a shutdown() on stop can never hit a reused fd.
+struct QueryServer::Connection {
+    QueryServer* server;
+    int fd;
+    pthread_t thread;
+    bool finished;
+};
+
+void* QueryServer::connectionThread(void* arg) {
+    Connection* conn = static_cast<Connection*>(arg);
+    QueryServer* server = conn->server;
+    server->serveConnection(conn->fd, conn->fd, false);
+    // The client sees the end of the replies now; the accept loop is woken
+    // to join this thread and close the fd
+    shutdown(conn->fd, SHUT_RDWR);
+    pthread_mutex_lock(&server->_connectionLock);
+    conn->finished = true;
+    pthread_mutex_unlock(&server->_connectionLock);
+    wake();
+    return NULL;
+}
+
+// Joins the client threads that are done. When stopping, first shuts down
+// the sockets of the others, which ends their reads and writes, and joins
+// them all: none of them may touch the server after serveSocket returns.
+void QueryServer::reapConnections(bool stopping) {
+    std::vector<Connection*> done;
+    pthread_mutex_lock(&_connectionLock);
+    size_t kept = 0;
+    for (size_t i = 0; i < _connections.size(); ++i) {
+        Connection* conn = _connections[i];
+        if (conn->finished || stopping) {
+            if (!conn->finished)
+                shutdown(conn->fd, SHUT_RDWR);
+            done.push_back(conn);
+        } else {
+            _connections[kept++] = conn;
+        }
+    }
+    _connections.resize(kept);
+    pthread_mutex_unlock(&_connectionLock);
+    for (size_t i = 0; i < done.size(); ++i) {
+        pthread_join(done[i]->thread, NULL);
+        close(done[i]->fd);
+        delete done[i];
+    }
+}
+
+int QueryServer::serveSocket(const std::string& path) {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: socket path too long." << std::endl;
+        return 1;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Error: could not create socket." << std::endl;
+        return 1;
+    }
+    unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        std::cerr << "Error: could not listen on " << path << "." << std::endl;
+        close(listener);
+        return 1;
+    }
+    if (!installSignals()) {
+        close(listener);
+        unlink(path.c_str());
+        return 1;
+    }
+    while (!g_stopRequested) {
+        reloadIfRequested();
+        reapConnections(false);
+        if (!waitReadable(listener))
+            continue;
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+            continue;
+        Connection* conn = new Connection;
+        conn->server = this;
+        conn->fd = fd;
+        conn->finished = false;
+        // Client threads start with the signals blocked, so the handlers
+        // run on this thread and the reload happens here
+        sigset_t block;
+        sigset_t previous;
+        sigemptyset(&block);
+        sigaddset(&block, SIGHUP);
+        sigaddset(&block, SIGINT);
+        sigaddset(&block, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &block, &previous);
+        // Listed before the thread starts, so its finished flag is only
+        // ever set on a connection reapConnections can see
+        pthread_mutex_lock(&_connectionLock);
+        _connections.push_back(conn);
+        const int created = pthread_create(&conn->thread, NULL, connectionThread, conn);
+        if (created != 0)
+            _connections.pop_back();
+        pthread_mutex_unlock(&_connectionLock);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+        if (created != 0) {
+            close(fd);
+            delete conn;
+        }
+    }
+    reapConnections(true);
+    close(listener);
+    unlink(path.c_str());
+    return 0;
+}
+
+// Minimal client: streams queries from in to the server and its replies to
+// out at the same time, so an arbitrarily long pipelined batch cannot
+// deadlock on full socket buffers. Returns 1 if any read or write fails or
+// the server hangs up before all replies are in.
+int QueryServer::runClient(const std::string& path, int in, int out) {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return 1;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Error: could not connect to " << path << "." << std::endl;
+        if (sock >= 0)
+            close(sock);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    std::vector<char> toSend;
+    size_t sent = 0;
+    std::vector<char> buf(READ_SIZE);
+    bool inputDone = false;
+    bool failed = false;
+    for (;;) {
+        struct pollfd fds[2];
+        int nfds = 0;
+        fds[nfds].fd = sock;
+        fds[nfds].events = POLLIN | (sent < toSend.size() ? POLLOUT : 0);
+        ++nfds;
+        if (!inputDone && sent == toSend.size()) {
+            fds[nfds].fd = in;
+            fds[nfds].events = POLLIN;
+            ++nfds;
+        }
+        if (poll(fds, static_cast<nfds_t>(nfds), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            failed = true;
+            break;
+        }
+        if (nfds == 2 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            ssize_t n = read(in, &buf[0], buf.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                failed = true;
+                break;
+            }
+            if (n == 0) {
+                inputDone = true;
+                shutdown(sock, SHUT_WR);
+            } else {
+                toSend.assign(buf.begin(), buf.begin() + n);
+                sent = 0;
+            }
+        }
+        if (fds[0].revents & POLLOUT) {
+            ssize_t n = write(sock, &toSend[sent], toSend.size() - sent);
+            if (n < 0 && errno != EINTR) {
+                failed = true;
+                break;
+            }
+            if (n > 0)
+                sent += static_cast<size_t>(n);
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(sock, &buf[0], buf.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            // End of replies is only expected once all input has been sent
+            if (n <= 0) {
+                failed = n < 0 || !inputDone;
+                break;
+            }
+            if (!writeAll(out, &buf[0], static_cast<size_t>(n))) {
+                failed = true;
+                break;
+            }
+        }
+    }
+    close(sock);
+    if (failed)
+        std::cerr << "Error: query through " << path << " failed." << std::endl;
+    return failed ? 1 : 0;
+}
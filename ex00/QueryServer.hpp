@@ -0,0 +1,51 @@
+#ifndef QUERYSERVER_HPP
+#define QUERYSERVER_HPP
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "SharedPtr.hpp"
+
+class BitcoinExchange;
+
+// Resident query service: loads the rate database once and answers
+// "date | value [| asset]" lines, one reply line per query line, over a
+// Unix domain socket (one thread per client) or over a stdin/stdout stream.
+// Clients may pipeline any number of queries; replies keep their order.
+// SIGHUP reloads the database: the new table is built while queries keep
+// running on the old one, then published by swapping one shared handle.
+// Each batch of queries holds a handle to the table it started with, so a
+// reload never waits for readers and readers never see a partial table.
+// serveSocket returns only once every client thread has been joined.
+class QueryServer {
+public:
+    QueryServer(const std::string& database, const std::string& snapshot, bool dense, bool fixedPoint, const std::string& asset);
+    ~QueryServer();
+
+    int serveStream(int in, int out);
+    int serveSocket(const std::string& path);
+    static int runClient(const std::string& path, int in, int out);
+private:
+    struct Connection;
+    BitcoinExchange* load() const;
+    void current(SharedPtr<BitcoinExchange>& exchange, unsigned long& generation);
+    void reloadIfRequested();
+    void serveConnection(int in, int out, bool handlesReload);
+    static void* connectionThread(void* arg);
+    void reapConnections(bool stopping);
+    QueryServer();
+    QueryServer(const QueryServer& other);
+    QueryServer& operator=(const QueryServer& other);
+    std::string _database;
+    std::string _snapshot;
+    bool _dense;
+    bool _fixedPoint;
+    std::string _asset;
+    SharedPtr<BitcoinExchange> _exchange;
+    pthread_mutex_t _lock;      // guards _exchange itself, not the table
+    volatile unsigned long _generation;  // bumped under _lock at every swap
+    std::vector<Connection*> _connections;  // client threads not joined yet
+    pthread_mutex_t _connectionLock;        // guards their finished flags
+};
+
+#endif // QUERYSERVER_HPP
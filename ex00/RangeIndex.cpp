@@ -0,0 +1,62 @@
+#include "RangeIndex.hpp"
+
+RangeIndex::RangeIndex() : _days(NULL), _rates(NULL) {}
+
+// days and rates must stay valid, and unchanged, while the index is used
+RangeIndex::RangeIndex(const int* days, const double* rates, size_t count)
+    : _days(days), _rates(rates), _prefix(count) {
+    for (size_t i = 1; i < count; ++i)
+        _prefix[i] = _prefix[i - 1] + rates[i - 1] * (days[i] - days[i - 1]);
+    if (count == 0)
+        return;
+    _min.push_back(std::vector<double>(rates, rates + count));
+    _max.push_back(_min.back());
+    for (size_t width = 2; width <= count; width *= 2) {
+        const std::vector<double>& lowerMin = _min.back();
+        const std::vector<double>& lowerMax = _max.back();
+        const size_t half = width / 2;
+        std::vector<double> levelMin(count - width + 1);
+        std::vector<double> levelMax(count - width + 1);
+        for (size_t i = 0; i < levelMin.size(); ++i) {
+            levelMin[i] = lowerMin[i] < lowerMin[i + half] ? lowerMin[i] : lowerMin[i + half];
+            levelMax[i] = lowerMax[i] > lowerMax[i + half] ? lowerMax[i] : lowerMax[i + half];
+        }
+        _min.push_back(levelMin);
+        _max.push_back(levelMax);
+    }
+}
+
+RangeIndex::RangeIndex(const RangeIndex& other)
+    : _days(other._days), _rates(other._rates), _prefix(other._prefix), _min(other._min), _max(other._max) {}
+
+RangeIndex& RangeIndex::operator=(const RangeIndex& other) {
+    if (this != &other) {
+        _days = other._days;
+        _rates = other._rates;
+        _prefix = other._prefix;
+        _min = other._min;
+        _max = other._max;
+    }
+    return *this;
+}
+
+RangeIndex::~RangeIndex() {}
+
+// Aggregates days [fromDay, toDay]; first and last are the entries in
+// effect on those two days (findFloor), first >= 0 and fromDay <= toDay
+void RangeIndex::query(long first, long last, int fromDay, int toDay, RangeStats& stats) const {
+    const size_t f = static_cast<size_t>(first);
+    const size_t l = static_cast<size_t>(last);
+    // Sum over [first entry's day, toDay] minus the sum over [.., fromDay)
+    const double through = _prefix[l] + _rates[l] * (toDay - _days[l] + 1);
+    const double before = _prefix[f] + _rates[f] * (fromDay - _days[f]);
+    stats.days = static_cast<long>(toDay) - fromDay + 1;
+    stats.sum = through - before;
+    // Two overlapping power-of-two windows cover entries [first, last]
+    size_t level = 0;
+    while ((static_cast<size_t>(2) << level) <= l - f + 1)
+        ++level;
+    const size_t second = l + 1 - (static_cast<size_t>(1) << level);
+    stats.min = _min[level][f] < _min[level][second] ? _min[level][f] : _min[level][second];
+    stats.max = _max[level][f] > _max[level][second] ? _max[level][f] : _max[level][second];
+}
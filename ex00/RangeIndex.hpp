@@ -0,0 +1,38 @@
+#ifndef RANGEINDEX_HPP
+#define RANGEINDEX_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Aggregate of the daily rate over a range of calendar days, each day
+// taking the rate of the closest entry on or before it
+struct RangeStats {
+    long days;
+    double sum;
+    double min;
+    double max;
+
+    double average() const { return sum / static_cast<double>(days); }
+};
+
+// Range aggregates over one rate column in O(1): a prefix sum of rate x
+// days covered per entry for sums, and a sparse table of the entries for
+// min and max. Built once over the sorted arrays of a RateTable.
+class RangeIndex {
+public:
+    RangeIndex();
+    RangeIndex(const int* days, const double* rates, size_t count);
+    RangeIndex(const RangeIndex& other);
+    RangeIndex& operator=(const RangeIndex& other);
+    ~RangeIndex();
+
+    void query(long first, long last, int fromDay, int toDay, RangeStats& stats) const;
+private:
+    const int* _days;
+    const double* _rates;
+    std::vector<double> _prefix;                // rate x days before each entry
+    std::vector<std::vector<double> > _min;     // level k: min of 2^k entries
+    std::vector<std::vector<double> > _max;
+};
+
+#endif // RANGEINDEX_HPP
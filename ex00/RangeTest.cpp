@@ -0,0 +1,81 @@
+// Differential test: RangeIndex (prefix sums + sparse table) against the
+// rates of every day in the range, read one at a time through findFloor.
+// Min and max must match exactly; sums within rounding of the prefix sums.
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+#include "RateTable.hpp"
+#include "TestSupport.hpp"
+
+static long g_checked = 0;
+
+static void check(const RateTable& table, int fromDay, int toDay) {
+    RangeStats got;
+    const bool found = table.rangeStats(fromDay, toDay, 0, got);
+    RangeStats want;
+    want.days = 0;
+    want.sum = 0;
+    bool wantFound = true;
+    for (int day = fromDay; day <= toDay; ++day) {
+        const long index = table.findFloor(day);
+        if (index < 0) {
+            wantFound = false;
+            break;
+        }
+        const double rate = table.rateAt(static_cast<size_t>(index));
+        want.min = want.days == 0 || rate < want.min ? rate : want.min;
+        want.max = want.days == 0 || rate > want.max ? rate : want.max;
+        want.sum += rate;
+        ++want.days;
+    }
+    ++g_checked;
+    bool ok = found == wantFound;
+    if (ok && found) {
+        ok = got.days == want.days && got.min == want.min && got.max == want.max
+            && std::fabs(got.sum - want.sum) <= 1e-9 * (std::fabs(want.sum) + 1);
+    }
+    if (!ok && g_failures++ < 20) {
+        std::cerr << "range mismatch [" << fromDay << ", " << toDay << "]: got " << found << " " << got.days
+            << " " << got.sum << " " << got.min << " " << got.max << ", want " << wantFound << " " << want.days
+            << " " << want.sum << " " << want.min << " " << want.max << std::endl;
+    }
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0x2545f491u) << 32) | 0x4f6cdd1du);
+    for (int round = 0; round < 200; ++round) {
+        // Random gaps between entries, inserted out of order with repeats
+        RateTable table;
+        const int first = 14000 + static_cast<int>(nextRandom() % 1000);
+        const int entries = 1 + static_cast<int>(nextRandom() % (round < 20 ? 4 : 400));
+        int day = first;
+        for (int i = 0; i < entries; ++i) {
+            table.insert(day, static_cast<double>(nextRandom() % 100000) / 100.0);
+            if (nextRandom() % 8 == 0)
+                table.insert(first + static_cast<int>(nextRandom() % static_cast<uint64_t>(day - first + 1)), 1.5);
+            day += 1 + static_cast<int>(nextRandom() % 30);
+        }
+        table.freeze();
+        const int span = day - first + 60;
+        for (int pass = 0; pass < 2; ++pass) {
+            // The walk over entries first, then the O(1) index
+            if (pass == 1)
+                table.buildRanges();
+            for (int q = 0; q < 300; ++q) {
+                const int from = first - 30 + static_cast<int>(nextRandom() % static_cast<uint64_t>(span));
+                const int to = from + static_cast<int>(nextRandom() % (q % 4 == 0 ? 3 : 400));
+                check(table, from, to);
+            }
+        }
+        // A copy must rebuild its index over its own arrays
+        RateTable copy(table);
+        table = RateTable();
+        for (int q = 0; q < 50; ++q) {
+            const int from = first + static_cast<int>(nextRandom() % static_cast<uint64_t>(span));
+            check(copy, from, from + static_cast<int>(nextRandom() % 100));
+        }
+    }
+    std::cout << "range_test: " << g_checked << " ranges, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,520 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+#include "MappedFile.hpp"
+#include "Hash.hpp"
+#include "RateTable.hpp"
+
+RateTable::RateTable()
+    : _names(1), _rates(1), _sorted(true), _dayData(NULL), _rateData(1, static_cast<const double*>(NULL)),
+      _count(0), _calendarStart(0) {}
+
+// A copy of a mapped snapshot uses the same mapping, which nothing writes
+// to, until it changes; any other copy owns its arrays
+RateTable::RateTable(const RateTable& other)
+    : _names(other._names), _rates(other._names.size()), _sorted(other._sorted), _dayData(other._dayData),
+      _rateData(other._rateData), _count(other._count), _mapping(other._mapping),
+      _calendar(other._calendar), _calendarStart(other._calendarStart), _fixed(other._fixed) {
+    if (_mapping.get()) {
+        _ranges = other._ranges;
+        return;
+    }
+    _days.assign(other._dayData, other._dayData + other._count);
+    for (size_t c = 0; c < _rates.size(); ++c)
+        _rates[c].assign(other._rateData[c], other._rateData[c] + other._count);
+    useOwnArrays();
+    // The original's indexes point into its own arrays
+    if (other.hasRanges())
+        buildRanges();
+}
+
+// Swapping vectors keeps their buffers, so the data pointers and indexes
+// taken over from the copy stay valid
+RateTable& RateTable::operator=(const RateTable& other) {
+    if (this != &other) {
+        RateTable copy(other);
+        _names.swap(copy._names);
+        _days.swap(copy._days);
+        _rates.swap(copy._rates);
+        _sorted = copy._sorted;
+        _dayData = copy._dayData;
+        _rateData.swap(copy._rateData);
+        _count = copy._count;
+        _mapping.swap(copy._mapping);
+        _calendar.swap(copy._calendar);
+        _calendarStart = copy._calendarStart;
+        _ranges.swap(copy._ranges);
+        _fixed.swap(copy._fixed);
+    }
+    return *this;
+}
+
+RateTable::~RateTable() {
+    release();
+}
+
+void RateTable::release() {
+    _mapping = SharedPtr<MappedFile>();
+}
+
+// Copies mapped snapshot data into owned arrays so the table can change
+void RateTable::detach() {
+    if (!_mapping.get())
+        return;
+    std::vector<int>(_dayData, _dayData + _count).swap(_days);
+    _rates.assign(_names.size(), std::vector<double>());
+    for (size_t c = 0; c < _rates.size(); ++c)
+        _rates[c].assign(_rateData[c], _rateData[c] + _count);
+    release();
+    useOwnArrays();
+}
+
+void RateTable::useOwnArrays() {
+    _count = _days.size();
+    _dayData = _days.empty() ? NULL : &_days[0];
+    _rateData.resize(_rates.size());
+    for (size_t c = 0; c < _rates.size(); ++c)
+        _rateData[c] = _rates[c].empty() ? NULL : &_rates[c][0];
+}
+
+// Empties the table and gives it one column per name; a table starts out
+// with a single unnamed column
+void RateTable::setColumns(const std::vector<std::string>& names) {
+    release();
+    clearCalendar();
+    clearRanges();
+    clearFixed();
+    _names = names;
+    if (_names.empty())
+        _names.resize(1);
+    std::vector<int>().swap(_days);
+    std::vector<std::vector<double> >(_names.size()).swap(_rates);
+    _sorted = true;
+    useOwnArrays();
+}
+
+size_t RateTable::columns() const {
+    return _names.size();
+}
+
+const std::string& RateTable::columnName(size_t column) const {
+    return _names[column];
+}
+
+// Column index of name, or -1 if the table has no such column
+long RateTable::findColumn(const std::string& name) const {
+    return findColumn(name.data(), name.size());
+}
+
+long RateTable::findColumn(const char* name, size_t len) const {
+    for (size_t c = 0; c < _names.size(); ++c) {
+        if (_names[c].compare(0, std::string::npos, name, len) == 0)
+            return static_cast<long>(c);
+    }
+    return -1;
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar
+int RateTable::dayNumber(int year, int month, int day) {
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int yoe = year - era * 400;
+    const int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Rows normally arrive in date order, so appending is the common case.
+// Anything else (out of order or a repeated date) is fixed up in freeze().
+void RateTable::insert(int day, double rate) {
+    insert(day, &rate);
+}
+
+// One row: a rate for every column, in column order
+void RateTable::insert(int day, const double* rates) {
+    detach();
+    clearCalendar();
+    clearRanges();
+    clearFixed();
+    if (!_days.empty() && day <= _days.back())
+        _sorted = false;
+    _days.push_back(day);
+    for (size_t c = 0; c < _rates.size(); ++c)
+        _rates[c].push_back(rates[c]);
+    useOwnArrays();
+}
+
+namespace {
+    struct DayLess {
+        const std::vector<int>* days;
+        bool operator()(size_t a, size_t b) const { return (*days)[a] < (*days)[b]; }
+    };
+}
+
+// Sort by date and keep the last value seen for a repeated date,
+// matching the previous std::map "_db[date] = value" behaviour
+void RateTable::freeze() {
+    if (_sorted)
+        return;
+    std::vector<size_t> order(_days.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    DayLess less;
+    less.days = &_days;
+    std::stable_sort(order.begin(), order.end(), less);
+    std::vector<int> days;
+    std::vector<size_t> rows;
+    days.reserve(order.size());
+    rows.reserve(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        const size_t src = order[i];
+        if (!days.empty() && days.back() == _days[src])
+            rows.back() = src;
+        else {
+            days.push_back(_days[src]);
+            rows.push_back(src);
+        }
+    }
+    for (size_t c = 0; c < _rates.size(); ++c) {
+        std::vector<double> rates(rows.size());
+        for (size_t i = 0; i < rows.size(); ++i)
+            rates[i] = _rates[c][rows[i]];
+        _rates[c].swap(rates);
+    }
+    _days.swap(days);
+    _sorted = true;
+    useOwnArrays();
+}
+
+// Index of the last entry whose date is <= day, or -1 if there is none.
+// The loop body has no data-dependent branch: the compiler turns the
+// select into a conditional move, so the search never mispredicts.
+long RateTable::findFloor(int day) const {
+    size_t n = _count;
+    if (n == 0)
+        return -1;
+    const int* base = _dayData;
+    if (day < base[0])
+        return -1;
+    while (n > 1) {
+        const size_t half = n / 2;
+        base = (base[half] <= day) ? base + half : base;
+        n -= half;
+    }
+    return static_cast<long>(base - _dayData);
+}
+
+// Expands the table into one entry index per day from its first entry up to
+// and including lastDay. About 33k slots cover every date btc accepts.
+void RateTable::buildCalendar(int lastDay) {
+    clearCalendar();
+    if (_count == 0 || lastDay < _dayData[0])
+        return;
+    _calendarStart = _dayData[0];
+    _calendar.resize(static_cast<size_t>(lastDay - _dayData[0]) + 1);
+    size_t entry = 0;
+    for (size_t slot = 0; slot < _calendar.size(); ++slot) {
+        const int day = _dayData[0] + static_cast<int>(slot);
+        while (entry + 1 < _count && _dayData[entry + 1] <= day)
+            ++entry;
+        _calendar[slot] = static_cast<int>(entry);
+    }
+}
+
+void RateTable::clearCalendar() {
+    if (!_calendar.empty())
+        std::vector<int>().swap(_calendar);
+}
+
+// Range aggregates for every column, kept until the table changes
+void RateTable::buildRanges() {
+    clearRanges();
+    for (size_t c = 0; c < _rateData.size(); ++c)
+        _ranges.push_back(RangeIndex(_dayData, _rateData[c], _count));
+}
+
+void RateTable::clearRanges() {
+    if (!_ranges.empty())
+        std::vector<RangeIndex>().swap(_ranges);
+}
+
+// Every column converted to Fixed, kept until the table changes.
+// A rate goes through its 15 significant digits, which are the digits it
+// was written with whenever the source had no more than that, so
+// "47115.93" becomes exactly 4711593000000 units and not the nearest
+// double scaled up.
+void RateTable::buildFixed() {
+    clearFixed();
+    _fixed.resize(_rateData.size());
+    for (size_t c = 0; c < _rateData.size(); ++c) {
+        _fixed[c].resize(_count);
+        for (size_t i = 0; i < _count; ++i) {
+            char text[32];
+            const int len = std::snprintf(text, sizeof(text), "%.15g", _rateData[c][i]);
+            if (len <= 0 || !parseFixed(text, static_cast<size_t>(len), _fixed[c][i]))
+                _fixed[c][i] = FIXED_MAX;
+        }
+    }
+}
+
+void RateTable::clearFixed() {
+    if (!_fixed.empty())
+        std::vector<std::vector<Fixed> >().swap(_fixed);
+}
+
+// Sum, min and max of the rate in effect on each day of [fromDay, toDay].
+// False if fromDay is before the first entry. O(1) after buildRanges(),
+// otherwise one pass over the entries in the range.
+bool RateTable::rangeStats(int fromDay, int toDay, size_t column, RangeStats& stats) const {
+    const long first = findFloor(fromDay);
+    if (first < 0)
+        return false;
+    const long last = findFloor(toDay);
+    if (!_ranges.empty()) {
+        _ranges[column].query(first, last, fromDay, toDay, stats);
+        return true;
+    }
+    const double* rates = _rateData[column];
+    stats.days = static_cast<long>(toDay) - fromDay + 1;
+    stats.sum = 0;
+    stats.min = rates[first];
+    stats.max = rates[first];
+    for (long i = first; i <= last; ++i) {
+        const int start = i == first ? fromDay : _dayData[i];
+        const int end = i == last ? toDay : _dayData[i + 1] - 1;
+        stats.sum += rates[i] * (end - start + 1);
+        stats.min = rates[i] < stats.min ? rates[i] : stats.min;
+        stats.max = rates[i] > stats.max ? rates[i] : stats.max;
+    }
+    return true;
+}
+
+// Same result as findFloor(day), starting from where the cursor's previous
+// lookup ended. While dates do not go backwards the answer is usually the
+// same entry or the next one; otherwise the search gallops from there.
+long RateTable::findFloor(int day, LookupCursor& cursor) const {
+    ++cursor.lookups;
+    if (!cursor.started || _count == 0) {
+        cursor.started = true;
+        cursor.index = findFloor(day);
+    } else {
+        if (day >= cursor.day)
+            ++cursor.sequential;
+        cursor.index = gallop(cursor.index < 0 ? 0 : cursor.index, day);
+    }
+    cursor.day = day;
+    return cursor.index;
+}
+
+// Exponential search outward from index "from" for the floor of day,
+// then a binary search inside the bracket it found
+long RateTable::gallop(long from, int day) const {
+    const long n = static_cast<long>(_count);
+    long lo;
+    long hi;
+    if (_dayData[from] <= day) {
+        // Forward: _dayData[lo] <= day, and day < _dayData[hi] or hi == n
+        lo = from;
+        long step = 1;
+        hi = lo + 1;
+        while (hi < n && _dayData[hi] <= day) {
+            lo = hi;
+            step <<= 1;
+            hi = lo + step;
+        }
+        if (hi > n)
+            hi = n;
+    } else {
+        // Backward: day < _dayData[hi], and _dayData[lo] <= day or lo == -1
+        hi = from;
+        long step = 1;
+        lo = hi - 1;
+        while (lo >= 0 && _dayData[lo] > day) {
+            hi = lo;
+            step <<= 1;
+            lo = hi - step;
+        }
+        if (lo < -1)
+            lo = -1;
+    }
+    while (hi - lo > 1) {
+        const long mid = lo + (hi - lo) / 2;
+        if (_dayData[mid] <= day)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int RateTable::dayAt(size_t index) const {
+    return _dayData[index];
+}
+
+double RateTable::rateAt(size_t index, size_t column) const {
+    return _rateData[column][index];
+}
+
+size_t RateTable::size() const {
+    return _count;
+}
+
+bool RateTable::empty() const {
+    return _count == 0;
+}
+
+// ---- Binary snapshot ----
+//
+// Layout (native byte order, checked through byteOrder):
+//   SnapshotHeader                      80 bytes
+//   column names                        NUL-terminated, padded to 8 bytes
+//   int32 days[count]                   padded to a multiple of 8 bytes
+//   double rates[columns][count]        one column after the other
+// The header records the size, mtime (to the nanosecond) and FNV-1a hash
+// of the CSV it was compiled from, the second the snapshot was written,
+// plus a hash of everything after the header.
+
+namespace {
+    const char SNAPSHOT_MAGIC[8] = { 'B', 'T', 'C', 'R', 'A', 'T', 'E', 'S' };
+    const uint32_t SNAPSHOT_VERSION = 3;
+    const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t count;
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        int64_t sourceMtimeNs;
+        uint64_t sourceHash;
+        int64_t writtenAt;      // time() once the source was hashed
+        uint64_t payloadHash;
+        uint32_t columns;
+        uint32_t namesBytes;    // unpadded
+    };
+
+    size_t padded(size_t bytes) {
+        return (bytes + 7) & ~static_cast<size_t>(7);
+    }
+
+    int64_t mtimeNanos(const struct stat& st) {
+#if defined(__APPLE__)
+        return static_cast<int64_t>(st.st_mtimespec.tv_nsec);
+#else
+        return static_cast<int64_t>(st.st_mtim.tv_nsec);
+#endif
+    }
+
+    bool hashFile(const std::string& path, uint64_t& hash) {
+        MappedFile file(path);
+        if (!file.isOpen())
+            return false;
+        hash = fnv1a(file.data(), file.size());
+        return true;
+    }
+}
+
+bool RateTable::writeSnapshot(const std::string& path, const std::string& sourcePath) const {
+    struct stat st;
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    if (stat(sourcePath.c_str(), &st) != 0 || !hashFile(sourcePath, header.sourceHash))
+        return false;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.count = _count;
+    header.sourceSize = static_cast<uint64_t>(st.st_size);
+    header.sourceMtime = static_cast<int64_t>(st.st_mtime);
+    header.sourceMtimeNs = mtimeNanos(st);
+    header.writtenAt = static_cast<int64_t>(std::time(NULL));
+    header.columns = static_cast<uint32_t>(_names.size());
+
+    std::string names;
+    for (size_t c = 0; c < _names.size(); ++c)
+        names.append(_names[c].c_str(), _names[c].size() + 1);
+    header.namesBytes = static_cast<uint32_t>(names.size());
+    const size_t daysAt = padded(names.size());
+    const size_t ratesAt = daysAt + padded(_count * sizeof(int32_t));
+    std::vector<char> payload(ratesAt + _names.size() * _count * sizeof(double), 0);
+    std::memcpy(&payload[0], names.data(), names.size());
+    for (size_t i = 0; i < _count; ++i) {
+        const int32_t day = _dayData[i];
+        std::memcpy(&payload[daysAt + i * sizeof(int32_t)], &day, sizeof(day));
+    }
+    for (size_t c = 0; _count && c < _names.size(); ++c)
+        std::memcpy(&payload[ratesAt + c * _count * sizeof(double)], _rateData[c], _count * sizeof(double));
+    header.payloadHash = fnv1a(&payload[0], payload.size());
+
+    // Write next to the target and rename, so readers never map a partial file
+    const std::string tmp = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1
+        && std::fwrite(&payload[0], payload.size(), 1, f) == 1;
+    ok = (std::fclose(f) == 0) && ok;
+    if (ok && std::rename(tmp.c_str(), path.c_str()) == 0)
+        return true;
+    std::remove(tmp.c_str());
+    return false;
+}
+
+// Maps a snapshot and uses its arrays in place. Returns false, leaving the
+// table untouched, if the file is missing, damaged, from another version
+// or byte order, or was compiled from a different revision of sourcePath.
+bool RateTable::loadSnapshot(const std::string& path, const std::string& sourcePath) {
+    MappedFile* file = new MappedFile(path);
+    const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(file->data());
+    bool ok = file->isOpen() && file->size() >= sizeof(SnapshotHeader)
+        && std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0
+        && header->version == SNAPSHOT_VERSION
+        && header->byteOrder == SNAPSHOT_BYTE_ORDER
+        && header->columns >= 1 && header->columns <= file->size()
+        && header->count <= file->size() && header->namesBytes <= file->size()
+        && file->size() == sizeof(SnapshotHeader) + padded(header->namesBytes)
+            + padded(header->count * sizeof(int32_t)) + header->columns * header->count * sizeof(double);
+    if (ok) {
+        // The size and the exact mtime are enough only for a source last
+        // written in an earlier second than the snapshot: in that second,
+        // an edit after compiling can leave the mtime as it was, as
+        // filesystem timestamps are coarse. Otherwise, and for a touched
+        // source, the hash decides.
+        struct stat st;
+        uint64_t hash;
+        ok = stat(sourcePath.c_str(), &st) == 0
+            && header->sourceSize == static_cast<uint64_t>(st.st_size)
+            && ((header->sourceMtime == static_cast<int64_t>(st.st_mtime)
+                    && header->sourceMtimeNs == mtimeNanos(st)
+                    && header->sourceMtime < header->writtenAt)
+                || (hashFile(sourcePath, hash) && hash == header->sourceHash));
+    }
+    const char* payload = ok ? file->data() + sizeof(SnapshotHeader) : NULL;
+    if (ok)
+        ok = fnv1a(payload, file->size() - sizeof(SnapshotHeader)) == header->payloadHash;
+    std::vector<std::string> names;
+    for (const char* p = payload, *end = payload + (ok ? header->namesBytes : 0); p < end; p += names.back().size() + 1) {
+        const char* nul = static_cast<const char*>(std::memchr(p, '\0', static_cast<size_t>(end - p)));
+        if (!nul)
+            break;
+        names.push_back(std::string(p, nul));
+    }
+    if (!ok || names.size() != header->columns) {
+        delete file;
+        return false;
+    }
+    setColumns(names);
+    _mapping = SharedPtr<MappedFile>(file);
+    _count = static_cast<size_t>(header->count);
+    const char* days = payload + padded(header->namesBytes);
+    const char* rates = days + padded(_count * sizeof(int32_t));
+    _dayData = reinterpret_cast<const int*>(days);
+    for (size_t c = 0; c < _rateData.size(); ++c)
+        _rateData[c] = reinterpret_cast<const double*>(rates + c * _count * sizeof(double));
+    return true;
+}
@@ -0,0 +1,103 @@
+#ifndef RATETABLE_HPP
+#define RATETABLE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "RangeIndex.hpp"
+#include "FixedPoint.hpp"
+#include "SharedPtr.hpp"
+
+class MappedFile;
+
+// Where the previous lookup of a stream landed. Lets a stream of
+// non-decreasing dates walk the table forward like a merge join
+// instead of searching it from scratch for every line.
+struct LookupCursor {
+    LookupCursor() : index(-1), day(0), started(false), lookups(0), sequential(0) {}
+    long index;
+    int day;
+    bool started;
+    unsigned long lookups;
+    unsigned long sequential; // lookups whose date was >= the previous one
+};
+
+// Packed, sorted rate table.
+// Dates are stored as integer day numbers in one contiguous array and the
+// rates in parallel arrays, one per named column (asset), so a lookup is a
+// branchless binary search over plain ints instead of a tree walk with
+// string compares, and the index it finds is valid for every column.
+// The arrays are either built in memory (insert + freeze) or used in place
+// from a binary snapshot file (loadSnapshot).
+class RateTable {
+public:
+    RateTable();
+    RateTable(const RateTable& other);
+    RateTable& operator=(const RateTable& other);
+    ~RateTable();
+
+    static int dayNumber(int year, int month, int day);
+
+    void setColumns(const std::vector<std::string>& names);
+    size_t columns() const;
+    const std::string& columnName(size_t column) const;
+    long findColumn(const std::string& name) const;
+    long findColumn(const char* name, size_t len) const;
+
+    void insert(int day, double rate);
+    void insert(int day, const double* rates);
+    void freeze();
+    long findFloor(int day) const;
+    long findFloor(int day, LookupCursor& cursor) const;
+    int dayAt(size_t index) const;
+    double rateAt(size_t index, size_t column = 0) const;
+    size_t size() const;
+    bool empty() const;
+
+    void buildCalendar(int lastDay);
+    void clearCalendar();
+    bool hasCalendar() const { return !_calendar.empty(); }
+
+    // Dense lookup: one slot per calendar day from the first entry on,
+    // holding the index findFloor would return, so finding it is a
+    // subtraction and an array read. -1 for a day before the first entry.
+    long calendarFloor(int day) const {
+        const long index = static_cast<long>(day) - _calendarStart;
+        if (index < 0)
+            return -1;
+        const size_t slot = static_cast<size_t>(index);
+        return _calendar[slot < _calendar.size() ? slot : _calendar.size() - 1];
+    }
+
+    void buildRanges();
+    void clearRanges();
+    bool hasRanges() const { return !_ranges.empty(); }
+    bool rangeStats(int fromDay, int toDay, size_t column, RangeStats& stats) const;
+
+    void buildFixed();
+    void clearFixed();
+    bool hasFixed() const { return !_fixed.empty(); }
+    Fixed fixedAt(size_t index, size_t column = 0) const { return _fixed[column][index]; }
+
+    bool writeSnapshot(const std::string& path, const std::string& sourcePath) const;
+    bool loadSnapshot(const std::string& path, const std::string& sourcePath);
+private:
+    long gallop(long from, int day) const;
+    void release();
+    void detach();
+    void useOwnArrays();
+    std::vector<std::string> _names;
+    std::vector<int> _days;
+    std::vector<std::vector<double> > _rates;   // one vector per column
+    bool _sorted;
+    const int* _dayData;
+    std::vector<const double*> _rateData;       // start of each column
+    size_t _count;
+    SharedPtr<MappedFile> _mapping;             // shared by copies, never written
+    std::vector<int> _calendar;
+    long _calendarStart;
+    std::vector<RangeIndex> _ranges;            // one per column, when built
+    std::vector<std::vector<Fixed> > _fixed;    // rates as Fixed, when built
+};
+
+#endif // RATETABLE_HPP
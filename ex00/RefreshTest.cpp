@@ -0,0 +1,125 @@
+// BitcoinExchange::refresh against a database file changed under it:
+// appended rows are merged in, and any edit to rows already loaded (same
+// length, anywhere in the file), a truncation or a replaced file makes it
+// parse everything again. After each refresh every day must have the rate
+// the file now gives it.
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include "BitcoinExchange.hpp"
+#include "TestSupport.hpp"
+
+static long g_refreshes = 0;
+
+// One database row: a day (the 1st to the 28th of each month from 2010)
+// and a rate that always takes "dddd.dd", so edits keep the length
+struct Row {
+    int day;
+    char text[32];
+};
+
+static Row makeRow(size_t index, unsigned rate) {
+    Row row;
+    const int year = 2010 + static_cast<int>(index / (12 * 28));
+    const int month = 1 + static_cast<int>(index / 28 % 12);
+    const int date = 1 + static_cast<int>(index % 28);
+    row.day = RateTable::dayNumber(year, month, date);
+    std::snprintf(row.text, sizeof(row.text), "%04d-%02d-%02d,%04u.%02u\n", year, month, date,
+        1000 + rate % 9000, rate / 9000 % 100);
+    return row;
+}
+
+static unsigned randomRate() {
+    return static_cast<unsigned>(nextRandom() % (9000 * 100));
+}
+
+static std::string fileText(const std::vector<Row>& rows) {
+    std::string text = "date,exchange_rate\n";
+    for (size_t i = 0; i < rows.size(); ++i)
+        text += rows[i].text;
+    return text;
+}
+
+// Writes text over the file in place, keeping its inode
+static bool writeFile(const std::string& path, const std::string& text, const char* mode) {
+    std::FILE* f = std::fopen(path.c_str(), mode);
+    if (!f)
+        return false;
+    const bool ok = std::fwrite(text.data(), 1, text.size(), f) == text.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+static const char* resultName(BitcoinExchange::RefreshResult result) {
+    return result == BitcoinExchange::REFRESH_UNCHANGED ? "unchanged"
+        : result == BitcoinExchange::REFRESH_APPENDED ? "appended" : "reloaded";
+}
+
+static void check(BitcoinExchange& exchange, const std::vector<Row>& rows, BitcoinExchange::RefreshResult want,
+    const std::string& change) {
+    ++g_refreshes;
+    const BitcoinExchange::RefreshResult got = exchange.refresh();
+    if (got != want)
+        fail(change + ": refresh() " + resultName(got) + ", want " + resultName(want));
+    if (exchange.size() != rows.size()) {
+        fail(change + ": wrong number of rows after refresh()");
+        return;
+    }
+    for (size_t i = 0; i < rows.size(); ++i) {
+        double rate = 0;
+        if (!exchange.rateOn(rows[i].day, rate) || rate != std::strtod(rows[i].text + 11, NULL)) {
+            fail(change + ": stale rate for " + std::string(rows[i].text, 10));
+            return;
+        }
+    }
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0x510e527fu) << 32) | 0xade682d1u);
+    char path[] = "/tmp/refresh_test.XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "refresh_test: no temporary file" << std::endl;
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    std::vector<Row> rows;
+    for (size_t i = 0; i < 3000; ++i)
+        rows.push_back(makeRow(i, randomRate()));
+    writeFile(path, fileText(rows), "w");
+    BitcoinExchange exchange(path, ',');
+
+    check(exchange, rows, BitcoinExchange::REFRESH_UNCHANGED, "no change");
+    for (int round = 0; round < 50; ++round) {
+        // A rate in the middle of the file, well away from either end
+        const size_t middle = rows.size() / 4 + static_cast<size_t>(nextRandom() % (rows.size() / 2));
+        rows[middle] = makeRow(middle, randomRate());
+        writeFile(path, fileText(rows), "r+");
+        check(exchange, rows, BitcoinExchange::REFRESH_RELOADED, "same-length edit of row " + std::string(rows[middle].text, 10));
+
+        const size_t added = 1 + static_cast<size_t>(nextRandom() % 5);
+        std::string tail;
+        for (size_t k = 0; k < added; ++k) {
+            rows.push_back(makeRow(rows.size(), randomRate()));
+            tail += rows.back().text;
+        }
+        writeFile(path, tail, "a");
+        check(exchange, rows, BitcoinExchange::REFRESH_APPENDED, "append");
+    }
+    rows.resize(rows.size() / 2);
+    truncate(path, 0);
+    writeFile(path, fileText(rows), "r+");
+    check(exchange, rows, BitcoinExchange::REFRESH_RELOADED, "truncation");
+    const std::string other = std::string(path) + ".new";
+    rows.resize(rows.size() - 1);
+    if (!writeFile(other, fileText(rows), "w") || std::rename(other.c_str(), path) != 0)
+        fail("could not replace the database file");
+    check(exchange, rows, BitcoinExchange::REFRESH_RELOADED, "replaced file");
+    unlink(path);
+
+    std::cout << "refresh_test: " << g_refreshes << " refreshes, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
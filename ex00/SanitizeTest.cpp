@@ -0,0 +1,95 @@
+// Built with AddressSanitizer and UBSan: every line is copied into a heap
+// block of exactly its own length, so a scan that reads one byte past the
+// end of a line stops the test. The prefix scans, both field parsers and
+// answerQuery (the server's path) run on short and mutated lines, and the
+// exact-size answers must match those for the same text in a roomy buffer.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "BitcoinExchange.hpp"
+#include "LineParser.hpp"
+#include "TestSupport.hpp"
+
+static long g_lines = 0;
+
+static std::string answer(const BitcoinExchange& exchange, const char* text, size_t len) {
+    const LineSlice slice = { text, len };
+    std::vector<char> response;
+    exchange.answerQuery(slice, '|', response);
+    return std::string(response.begin(), response.end());
+}
+
+static void check(const std::vector<BitcoinExchange*>& exchanges, const std::string& text) {
+    // new char[0] is still a distinct block ASan knows the size of
+    char* exact = new char[text.size()];
+    std::memcpy(exact, text.data(), text.size());
+    std::vector<char> roomy(text.begin(), text.end());
+    roomy.resize(text.size() + 64, '0');
+
+    int vectorDay = -1;
+    int scalarDay = -1;
+    const PrefixScan got = scanDatePrefix(exact, text.size(), '|', vectorDay);
+    const PrefixScan want = scanDatePrefixScalar(exact, text.size(), '|', scalarDay);
+    if (got != want || (got == PREFIX_DATE && vectorDay != scalarDay))
+        fail("prefix mismatch: \"" + text + "\"");
+    int day;
+    double value;
+    parseDate(exact, text.size(), day);
+    parseValue(exact, text.size(), value);
+    for (size_t i = 0; i < exchanges.size(); ++i) {
+        if (answer(*exchanges[i], exact, text.size()) != answer(*exchanges[i], &roomy[0], text.size()))
+            fail("answer mismatch: \"" + text + "\"");
+    }
+    delete[] exact;
+    ++g_lines;
+}
+
+// A well-formed query, then cut short, mutated or given an asset field
+static std::string randomLine() {
+    char buf[64];
+    std::sprintf(buf, "%04u-%02u-%02u | %u", unsigned(2008 + nextRandom() % 8), unsigned(nextRandom() % 14),
+                 unsigned(nextRandom() % 33), unsigned(nextRandom() % 1200));
+    std::string line(buf);
+    if (nextRandom() % 4 == 0)
+        line += nextRandom() % 2 ? ".5" : "e2";
+    if (nextRandom() % 6 == 0)
+        line += " | btc";
+    if (nextRandom() % 3 == 0)
+        line[nextRandom() % line.size()] = "0123456789-| .e\t"[nextRandom() % 16];
+    if (nextRandom() % 2)
+        line.resize(nextRandom() % (line.size() + 1));
+    return line;
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0x9b05688cu) << 32) | 0x2b3e6c1fu);
+    BitcoinExchange plain("data.csv", ',');
+    BitcoinExchange dense(plain);
+    dense.setDenseLookup(true);
+    BitcoinExchange fixed(plain);
+    fixed.setFixedPoint(true);
+    std::vector<BitcoinExchange*> exchanges;
+    exchanges.push_back(&plain);
+    exchanges.push_back(&dense);
+    exchanges.push_back(&fixed);
+
+    // Every prefix of a few typical lines, down to the empty line
+    static const char* lines[] = {
+        "2011-01-03 | 3", "2011-01-03 | 1.5", "2011-01-03 | 1000", "2011-01-03 | -1", "2001-42-42",
+        "2011-01-03|3", "2011-01-03 | 3 | btc", "date | value", NULL
+    };
+    for (int i = 0; lines[i]; ++i) {
+        const std::string line(lines[i]);
+        for (size_t len = 0; len <= line.size(); ++len)
+            check(exchanges, line.substr(0, len));
+    }
+    for (int i = 0; i < 20000; ++i)
+        check(exchanges, randomLine());
+
+    std::cout << "sanitize_test: " << g_lines << " lines, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,66 @@
+#ifndef SHAREDPTR_HPP
+#define SHAREDPTR_HPP
+
+#include <cstddef>
+
+// Reference-counted owner of a heap object, for C++98.
+// The count is updated with atomic builtins, so handles to the same object
+// may be copied and dropped from different threads; the object is deleted
+// with the last handle. A single handle is not itself thread-safe: threads
+// that share one variable must guard its reads and assignments.
+template <typename T>
+class SharedPtr {
+public:
+    SharedPtr() : _ptr(NULL), _refs(NULL) {}
+
+    explicit SharedPtr(T* ptr) : _ptr(ptr), _refs(NULL) {
+        try {
+            if (_ptr)
+                _refs = new long(1);
+        } catch (...) {
+            delete _ptr;
+            throw;
+        }
+    }
+
+    SharedPtr(const SharedPtr& other) : _ptr(other._ptr), _refs(other._refs) {
+        if (_refs)
+            __sync_add_and_fetch(_refs, 1);
+    }
+
+    SharedPtr& operator=(const SharedPtr& other) {
+        SharedPtr copy(other);
+        swap(copy);
+        return *this;
+    }
+
+    ~SharedPtr() {
+        if (_refs && __sync_sub_and_fetch(_refs, 1) == 0) {
+            delete _ptr;
+            delete _refs;
+        }
+    }
+
+    void swap(SharedPtr& other) {
+        T* ptr = _ptr;
+        long* refs = _refs;
+        _ptr = other._ptr;
+        _refs = other._refs;
+        other._ptr = ptr;
+        other._refs = refs;
+    }
+
+    T* get() const { return _ptr; }
+    T& operator*() const { return *_ptr; }
+    T* operator->() const { return _ptr; }
+
+    // True if this is the only handle, so the object may be changed in place
+    bool unique() const {
+        return _refs && __sync_add_and_fetch(_refs, 0) == 1;
+    }
+private:
+    T* _ptr;
+    long* _refs;
+};
+
+#endif // SHAREDPTR_HPP
@@ -0,0 +1,154 @@
+// BitcoinExchange's snapshot constructor against a database edited after
+// "btc --compile": the snapshot may only be used while it still matches
+// the CSV, and every other case must fall back to parsing the CSV. Edits
+// keep the file size and put the old mtime back, as an edit within one
+// tick of a coarse filesystem clock leaves it.
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "BitcoinExchange.hpp"
+#include "TestSupport.hpp"
+
+static long g_loads = 0;
+
+// Rates always take "ddd", so an edit keeps the file size
+static std::string csvText(const std::vector<unsigned>& rates) {
+    std::string text = "date,exchange_rate\n";
+    char line[32];
+    for (size_t i = 0; i < rates.size(); ++i) {
+        std::sprintf(line, "2010-01-%02u,%03u\n", unsigned(i + 1), rates[i]);
+        text += line;
+    }
+    return text;
+}
+
+static bool writeFile(const std::string& path, const std::string& text) {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+    const bool ok = std::fwrite(text.data(), 1, text.size(), f) == text.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+static void setMtime(const std::string& path, time_t seconds, long nanos) {
+    struct timespec times[2];
+    times[0].tv_sec = seconds;
+    times[0].tv_nsec = nanos;
+    times[1] = times[0];
+    if (utimensat(AT_FDCWD, path.c_str(), times, 0) != 0)
+        fail("could not set the mtime of " + path);
+}
+
+// Writes the CSV with the given mtime and compiles it
+static void compile(const std::string& csv, const std::string& bin, const std::vector<unsigned>& rates,
+    time_t seconds, long nanos) {
+    writeFile(csv, csvText(rates));
+    setMtime(csv, seconds, nanos);
+    BitcoinExchange(csv, ',').saveSnapshot(bin);
+}
+
+// Rewrites the CSV in place and puts the given mtime back
+static void rewrite(const std::string& csv, const std::vector<unsigned>& rates, time_t seconds, long nanos) {
+    writeFile(csv, csvText(rates));
+    setMtime(csv, seconds, nanos);
+}
+
+static void edit(std::vector<unsigned>& rates) {
+    const size_t at = static_cast<size_t>(nextRandom() % rates.size());
+    rates[at] = (rates[at] + 1 + static_cast<unsigned>(nextRandom() % 998)) % 1000;
+}
+
+// Loads through the snapshot constructor and wants exactly these rates
+static void check(const std::string& csv, const std::string& bin, const std::vector<unsigned>& want,
+    const std::string& change) {
+    ++g_loads;
+    BitcoinExchange exchange(csv, ',', bin);
+    for (size_t i = 0; i < want.size(); ++i) {
+        double rate = -1;
+        if (!exchange.rateOn(RateTable::dayNumber(2010, 1, static_cast<int>(i + 1)), rate) || rate != want[i]) {
+            char day[16];
+            std::sprintf(day, "2010-01-%02u", unsigned(i + 1));
+            fail(change + ": wrong rate for " + day);
+            return;
+        }
+    }
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0x1f83d9abu) << 32) | 0xfb41bd6bu);
+    char dir[] = "/tmp/snapshot_test.XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::cerr << "snapshot_test: no temporary directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string csv = std::string(dir) + "/data.csv";
+    const std::string bin = std::string(dir) + "/rates.bin";
+    std::vector<unsigned> rates;
+    for (int i = 0; i < 28; ++i)
+        rates.push_back(static_cast<unsigned>(nextRandom() % 1000));
+    const time_t past = std::time(NULL) - 3600;
+
+    for (int round = 0; round < 20; ++round) {
+        const long nanos = 1000 * round;
+        // Source last written in an earlier second: size and mtime are
+        // trusted, so even a same-size edit under the old mtime is not
+        // seen. This is what shows the snapshot is used at all.
+        std::vector<unsigned> edited(rates);
+        edit(edited);
+        compile(csv, bin, rates, past, nanos);
+        rewrite(csv, edited, past, nanos);
+        check(csv, bin, rates, "untouched source");
+
+        // The same, but the mtime differs in its nanoseconds only
+        setMtime(csv, past, nanos + 1);
+        check(csv, bin, edited, "mtime off by a nanosecond");
+
+        // Touched but unchanged: the hash matches
+        rewrite(csv, rates, past + 1, 0);
+        check(csv, bin, rates, "touched source");
+
+        // A damaged payload is never used, whatever the header says
+        compile(csv, bin, rates, past, nanos);
+        rewrite(csv, edited, past, nanos);
+        std::FILE* f = std::fopen(bin.c_str(), "r+");
+        if (f) {
+            std::fseek(f, -1, SEEK_END);
+            const int last = std::fgetc(f);
+            std::fseek(f, -1, SEEK_END);
+            std::fputc(last ^ 0x40, f);
+            std::fclose(f);
+        }
+        check(csv, bin, edited, "damaged snapshot");
+
+        // Source written in the second the snapshot is: an edit in that
+        // second can keep the mtime, so only the hash may vouch for it
+        time_t now;
+        do {
+            now = std::time(NULL);
+            compile(csv, bin, rates, now, nanos);
+        } while (std::time(NULL) != now);
+        rewrite(csv, edited, now, nanos);
+        check(csv, bin, edited, "same-second edit");
+
+        // A different size never matches
+        rates = edited;
+        rates.push_back(static_cast<unsigned>(nextRandom() % 1000));
+        if (rates.size() > 31)
+            rates.resize(28);
+        rewrite(csv, rates, past, nanos);
+        check(csv, bin, rates, "resized source");
+    }
+    unlink(csv.c_str());
+    unlink(bin.c_str());
+    rmdir(dir);
+
+    std::cout << "snapshot_test: " << g_loads << " loads, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
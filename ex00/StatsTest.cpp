@@ -0,0 +1,336 @@
+// The --stats JSON report and the --summary error line on inputs with a
+// known number of lines of each kind, serial and with -j 4: the report
+// must be one valid JSON object with every field in place and in order,
+// its counts must add up, and the input path and asset name, chosen to
+// need escaping, must read back exactly as they were.
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include "BitcoinExchange.hpp"
+#include "TestSupport.hpp"
+
+static long g_reports = 0;
+
+// Reads a JSON text into its leaves, in order, as "path" -> value, with
+// paths like "lines.read" or "lookup_latency_ns.3.lt". Strings are
+// unescaped; numbers and literals are kept as written.
+class JsonReader {
+public:
+    explicit JsonReader(const std::string& text) : _text(text), _pos(0) {}
+
+    bool read(std::vector<std::string>& paths, std::map<std::string, std::string>& values) {
+        _paths = &paths;
+        _values = &values;
+        if (!value(""))
+            return false;
+        skipSpace();
+        return _pos == _text.size();
+    }
+private:
+    void skipSpace() {
+        while (_pos < _text.size() && std::isspace(static_cast<unsigned char>(_text[_pos])))
+            ++_pos;
+    }
+
+    bool literal(const std::string& word) {
+        if (_text.compare(_pos, word.size(), word) != 0)
+            return false;
+        _pos += word.size();
+        return true;
+    }
+
+    bool string(std::string& out) {
+        if (!literal("\""))
+            return false;
+        while (_pos < _text.size()) {
+            const char c = _text[_pos++];
+            if (c == '"')
+                return true;
+            if (static_cast<unsigned char>(c) < 0x20 || _pos >= _text.size())
+                return false;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            const char e = _text[_pos++];
+            unsigned code;
+            if (e == '"' || e == '\\' || e == '/')
+                out += e;
+            else if (e == 'n' || e == 'r' || e == 't' || e == 'b' || e == 'f')
+                out += e == 'n' ? '\n' : e == 'r' ? '\r' : e == 't' ? '\t' : e == 'b' ? '\b' : '\f';
+            else if (e == 'u' && _pos + 4 <= _text.size() && std::sscanf(_text.substr(_pos, 4).c_str(), "%4x", &code) == 1
+                && code < 0x80) {
+                out += static_cast<char>(code);
+                _pos += 4;
+            } else
+                return false;
+        }
+        return false;
+    }
+
+    void put(const std::string& path, const std::string& value) {
+        _paths->push_back(path);
+        (*_values)[path] = value;
+    }
+
+    bool members(const std::string& path, bool object) {
+        const std::string close = object ? "}" : "]";
+        skipSpace();
+        if (literal(close))
+            return true;
+        for (int index = 0;; ++index) {
+            std::string key;
+            skipSpace();
+            if (object && !(string(key) && (skipSpace(), literal(":"))))
+                return false;
+            if (!object) {
+                char text[16];
+                std::sprintf(text, "%d", index);
+                key = text;
+            }
+            if (!value(path.empty() ? key : path + "." + key))
+                return false;
+            skipSpace();
+            if (literal(close))
+                return true;
+            if (!literal(","))
+                return false;
+        }
+    }
+
+    bool value(const std::string& path) {
+        static const char* const LITERALS[] = { "null", "true", "false", NULL };
+        skipSpace();
+        if (literal("{"))
+            return members(path, true);
+        if (literal("["))
+            return members(path, false);
+        std::string text;
+        if (_pos < _text.size() && _text[_pos] == '"') {
+            if (!string(text))
+                return false;
+            put(path, text);
+            return true;
+        }
+        for (int i = 0; LITERALS[i]; ++i) {
+            if (literal(LITERALS[i])) {
+                put(path, LITERALS[i]);
+                return true;
+            }
+        }
+        const size_t start = _pos;
+        literal("-");
+        while (_pos < _text.size() && (std::isdigit(static_cast<unsigned char>(_text[_pos])) || _text[_pos] == '.'))
+            ++_pos;
+        if (_pos == start || !std::isdigit(static_cast<unsigned char>(_text[_pos - 1])))
+            return false;
+        put(path, _text.substr(start, _pos - start));
+        return true;
+    }
+
+    const std::string& _text;
+    size_t _pos;
+    std::vector<std::string>* _paths;
+    std::map<std::string, std::string>* _values;
+};
+
+// Lines per BitcoinExchange::QueryError, in order
+struct Counts {
+    unsigned long kinds[BitcoinExchange::QUERY_ERROR_KINDS];
+};
+
+static bool writeFile(const std::string& path, const std::string& text) {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+    const bool ok = std::fwrite(text.data(), 1, text.size(), f) == text.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+// data.csv starts on 2009-01-02
+static std::string randomInput(Counts& counts) {
+    static const char* const BAD[] = { "", "2011-13-01 | 1", "2011-01-03 |", "2011-01-03 | 1x", "x | 1", "2011-01-03 | 1 | doge" };
+    std::string text = "date | value\n";
+    for (int kind = 0; kind < BitcoinExchange::QUERY_ERROR_KINDS; ++kind)
+        counts.kinds[kind] = 0;
+    for (int i = 0; i < 30000; ++i) {
+        char line[64];
+        const int kind = static_cast<int>(nextRandom() % BitcoinExchange::QUERY_ERROR_KINDS);
+        const unsigned year = unsigned(2009 + nextRandom() % 13);
+        const unsigned month = unsigned(2 + nextRandom() % 11);
+        const unsigned day = unsigned(1 + nextRandom() % 28);
+        switch (kind) {
+            case BitcoinExchange::QUERY_OK:
+                std::sprintf(line, "%04u-%02u-%02u | %u.5", year, month, day, unsigned(nextRandom() % 1000));
+                break;
+            case BitcoinExchange::QUERY_BAD_INPUT:
+                std::sprintf(line, "%s", BAD[nextRandom() % (sizeof(BAD) / sizeof(BAD[0]))]);
+                break;
+            case BitcoinExchange::QUERY_NOT_POSITIVE:
+                std::sprintf(line, "%04u-%02u-%02u | -%u", year, month, day, unsigned(1 + nextRandom() % 1000));
+                break;
+            case BitcoinExchange::QUERY_TOO_LARGE:
+                std::sprintf(line, "%04u-%02u-%02u | %u", year, month, day, unsigned(1001 + nextRandom() % 100000));
+                break;
+            default:
+                std::sprintf(line, "2009-01-01 | %u", unsigned(nextRandom() % 1000));
+                break;
+        }
+        text += std::string(line) + "\n";
+        ++counts.kinds[kind];
+    }
+    return text;
+}
+
+static std::string number(unsigned long n) {
+    char text[32];
+    std::sprintf(text, "%lu", n);
+    return text;
+}
+
+static void expectValue(const std::map<std::string, std::string>& values, const std::string& path,
+    const std::string& want, const std::string& what) {
+    std::map<std::string, std::string>::const_iterator it = values.find(path);
+    if (it == values.end())
+        fail(what + ": no " + path);
+    else if (it->second != want)
+        fail(what + ": " + path + " is \"" + it->second + "\", want \"" + want + "\"");
+}
+
+static unsigned long valueOf(const std::map<std::string, std::string>& values, const std::string& path) {
+    std::map<std::string, std::string>::const_iterator it = values.find(path);
+    return it == values.end() ? 0 : std::strtoul(it->second.c_str(), NULL, 10);
+}
+
+static void checkStats(const BitcoinExchange& base, const std::string& input, const std::string& asset,
+    const Counts& counts, int threads) {
+    BitcoinExchange exchange(base);
+    exchange.setThreadCount(threads);
+    exchange.setStats(true);
+    OutputCapture capture(false);
+    exchange.processFile(&input, '|');
+    std::string out;
+    std::string err;
+    capture.finish(out, err);
+    ++g_reports;
+
+    const std::string what = threads > 1 ? "--stats -j " + number(static_cast<unsigned long>(threads)) : "--stats";
+    // The report is the last line on stderr
+    const size_t start = err.rfind('\n', err.size() >= 2 ? err.size() - 2 : 0);
+    const std::string report = err.substr(start == std::string::npos ? 0 : start + 1);
+    if (report.empty() || report[report.size() - 1] != '\n' || report[0] != '{') {
+        fail(what + ": no report line");
+        return;
+    }
+    std::vector<std::string> paths;
+    std::map<std::string, std::string> values;
+    JsonReader reader(report);
+    if (!reader.read(paths, values)) {
+        fail(what + ": not valid JSON: " + report);
+        return;
+    }
+
+    std::string order;
+    for (size_t i = 0; i < paths.size(); ++i)
+        order += paths[i] + " ";
+    std::string wantOrder = "input asset phases_ms.db_load phases_ms.index phases_ms.open_input phases_ms.queries "
+        "phases_ms.parse phases_ms.lookup phases_ms.output phases_ms.flush phases_ms.total "
+        "lines.read lines.accepted lines.bad_input lines.not_positive lines.too_large lines.no_earlier_date "
+        "db.rows db.assets lookups.exact lookups.previous_date ";
+    for (int i = 0; i < BitcoinExchange::QueryStats::LATENCY_BUCKETS; ++i) {
+        const std::string bucket = "lookup_latency_ns." + number(static_cast<unsigned long>(i));
+        wantOrder += bucket + ".lt " + bucket + ".count ";
+    }
+    if (order != wantOrder)
+        fail(what + ": fields are " + order);
+
+    expectValue(values, "input", input, what);
+    expectValue(values, "asset", asset, what);
+    unsigned long total = 0;
+    for (int kind = 0; kind < BitcoinExchange::QUERY_ERROR_KINDS; ++kind)
+        total += counts.kinds[kind];
+    expectValue(values, "lines.read", number(total), what);
+    expectValue(values, "lines.accepted", number(counts.kinds[BitcoinExchange::QUERY_OK]), what);
+    expectValue(values, "lines.bad_input", number(counts.kinds[BitcoinExchange::QUERY_BAD_INPUT]), what);
+    expectValue(values, "lines.not_positive", number(counts.kinds[BitcoinExchange::QUERY_NOT_POSITIVE]), what);
+    expectValue(values, "lines.too_large", number(counts.kinds[BitcoinExchange::QUERY_TOO_LARGE]), what);
+    expectValue(values, "lines.no_earlier_date", number(counts.kinds[BitcoinExchange::QUERY_NO_EARLIER_DATE]), what);
+    expectValue(values, "db.rows", number(exchange.size()), what);
+    expectValue(values, "db.assets", number(exchange.assetCount()), what);
+    if (valueOf(values, "lookups.exact") + valueOf(values, "lookups.previous_date") != counts.kinds[BitcoinExchange::QUERY_OK])
+        fail(what + ": exact and previous-date lookups do not add up to the accepted lines");
+    unsigned long bucketed = 0;
+    for (int i = 0; i < BitcoinExchange::QueryStats::LATENCY_BUCKETS; ++i) {
+        const std::string bucket = "lookup_latency_ns." + number(static_cast<unsigned long>(i));
+        const bool last = i + 1 == BitcoinExchange::QueryStats::LATENCY_BUCKETS;
+        expectValue(values, bucket + ".lt", last ? "null" : number(32ul << i), what);
+        bucketed += valueOf(values, bucket + ".count");
+    }
+    if (bucketed != counts.kinds[BitcoinExchange::QUERY_OK] + counts.kinds[BitcoinExchange::QUERY_NO_EARLIER_DATE])
+        fail(what + ": latency buckets do not add up to the lookups made");
+}
+
+static void checkSummary(const BitcoinExchange& base, const std::string& input, const Counts& counts, int threads) {
+    BitcoinExchange exchange(base);
+    exchange.setThreadCount(threads);
+    exchange.setErrorSummary(true);
+    OutputCapture capture(false);
+    exchange.processFile(&input, '|');
+    std::string out;
+    std::string err;
+    capture.finish(out, err);
+    ++g_reports;
+
+    const std::string what = threads > 1 ? "--summary -j " + number(static_cast<unsigned long>(threads)) : "--summary";
+    const std::string want = "errors: bad input " + number(counts.kinds[BitcoinExchange::QUERY_BAD_INPUT])
+        + ", not a positive number " + number(counts.kinds[BitcoinExchange::QUERY_NOT_POSITIVE])
+        + ", too large a number " + number(counts.kinds[BitcoinExchange::QUERY_TOO_LARGE])
+        + ", no earlier date " + number(counts.kinds[BitcoinExchange::QUERY_NO_EARLIER_DATE]) + "\n";
+    if (err != want)
+        fail(what + ": stderr is \"" + err + "\", want \"" + want + "\"");
+    unsigned long results = 0;
+    for (size_t i = 0; i < out.size(); ++i)
+        results += out[i] == '\n';
+    if (results != counts.kinds[BitcoinExchange::QUERY_OK])
+        fail(what + ": stdout does not have one line per accepted query");
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0x428a2f98u) << 32) | 0xd728ae22u);
+    char dir[] = "/tmp/stats_test.XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::cerr << "stats_test: no temporary directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // Names that only survive as JSON if they are escaped
+    const std::string input = std::string(dir) + "/in \"put\"\\\t\x01.txt";
+    const std::string database = std::string(dir) + "/db.csv";
+    const std::string asset = "b\"t\\c";
+
+    BitcoinExchange plain("data.csv", ',');
+    writeFile(database, "date,x," + asset + "\n2009-01-02,1,2\n2010-06-01,3,4\n");
+    BitcoinExchange named(database, ',');
+    named.setAsset(asset);
+
+    for (int round = 0; round < 3; ++round) {
+        Counts counts;
+        writeFile(input, randomInput(counts));
+        for (int threads = 1; threads <= 4; threads += 3) {
+            checkStats(plain, input, "exchange_rate", counts, threads);
+            checkStats(named, input, asset, counts, threads);
+            checkSummary(plain, input, counts, threads);
+        }
+    }
+    unlink(input.c_str());
+    unlink(database.c_str());
+    rmdir(dir);
+
+    std::cout << "stats_test: " << g_reports << " reports, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,99 @@
+#ifndef TESTSUPPORT_HPP
+#define TESTSUPPORT_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <stdint.h>
+#include <unistd.h>
+
+// Shared by the test binaries: a xorshift64 stream that each test seeds
+// with its own constant, so a failing case reproduces run after run, a
+// failure counter that only prints the first few mismatches, and a capture
+// of what btc writes straight to file descriptors 1 and 2.
+
+static uint64_t g_seed = 1;
+static int g_failures = 0;
+
+static inline void seedRandom(uint64_t seed) {
+    g_seed = seed ? seed : 1;
+}
+
+static inline uint64_t nextRandom() {
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return g_seed;
+}
+
+static inline void fail(const std::string& what) {
+    if (g_failures++ < 20)
+        std::cerr << what << std::endl;
+}
+
+// Sends stdout and stderr to temporary files, or both to one file when
+// together is set, until finish() puts them back and returns what each got
+// (everything in out when together).
+class OutputCapture {
+public:
+    explicit OutputCapture(bool together) : _together(together) {
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(NULL);
+        _files[0] = openTemporary();
+        _files[1] = together ? -1 : openTemporary();
+        _saved[0] = dup(STDOUT_FILENO);
+        _saved[1] = dup(STDERR_FILENO);
+        dup2(_files[0], STDOUT_FILENO);
+        dup2(together ? _files[0] : _files[1], STDERR_FILENO);
+    }
+
+    ~OutputCapture() {
+        std::string out;
+        std::string err;
+        if (_saved[0] >= 0)
+            finish(out, err);
+    }
+
+    void finish(std::string& out, std::string& err) {
+        std::fflush(NULL);
+        dup2(_saved[0], STDOUT_FILENO);
+        dup2(_saved[1], STDERR_FILENO);
+        close(_saved[0]);
+        close(_saved[1]);
+        _saved[0] = -1;
+        out = readAll(_files[0]);
+        err = _together ? std::string() : readAll(_files[1]);
+    }
+private:
+    static int openTemporary() {
+        char path[] = "/tmp/btc_capture.XXXXXX";
+        const int fd = mkstemp(path);
+        if (fd < 0) {
+            std::cerr << "cannot create a temporary file" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        unlink(path);
+        return fd;
+    }
+
+    static std::string readAll(int fd) {
+        std::string text;
+        char buf[1 << 16];
+        ssize_t n;
+        lseek(fd, 0, SEEK_SET);
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            text.append(buf, static_cast<size_t>(n));
+        close(fd);
+        return text;
+    }
+
+    OutputCapture(const OutputCapture&);
+    OutputCapture& operator=(const OutputCapture&);
+    bool _together;
+    int _files[2];
+    int _saved[2];
+};
+
+#endif // TESTSUPPORT_HPP
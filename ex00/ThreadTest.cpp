@@ -0,0 +1,121 @@
+// "btc -j N" against the serial run on inputs large enough to be cut into
+// dozens of chunks: stdout and stderr must be byte for byte the same,
+// both when they go to separate files and when they share one, where
+// every error line has to land between the same two results.
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include "BitcoinExchange.hpp"
+#include "TestSupport.hpp"
+
+static long g_runs = 0;
+
+// Mostly good queries, with every kind of error, blank and odd lines,
+// and now and then a long one, so chunk boundaries fall anywhere
+static std::string randomLine() {
+    char buf[64];
+    const unsigned year = unsigned(2008 + nextRandom() % 16);
+    const unsigned month = unsigned(1 + nextRandom() % 12);
+    const unsigned day = unsigned(1 + nextRandom() % 28);
+    switch (nextRandom() % 16) {
+        case 0: std::sprintf(buf, "%04u-%02u-%02u | -%u", year, month, day, unsigned(nextRandom() % 100)); break;
+        case 1: std::sprintf(buf, "%04u-%02u-%02u | %u", year, month, day, unsigned(1001 + nextRandom() % 9000)); break;
+        case 2: std::sprintf(buf, "%04u-%02u-%02u", year, month, day); break;
+        case 3: std::sprintf(buf, "%04u-%02u-%02u | %u", year, 13 + unsigned(nextRandom() % 3), day, 1u); break;
+        case 4: return "";
+        case 5: return std::string(100 + nextRandom() % 400, 'x');
+        default:
+            std::sprintf(buf, "%04u-%02u-%02u | %u.%02u", year, month, day, unsigned(nextRandom() % 1000),
+                unsigned(nextRandom() % 100));
+            break;
+    }
+    return buf;
+}
+
+static bool writeFile(const std::string& path, const std::string& text) {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+    const bool ok = std::fwrite(text.data(), 1, text.size(), f) == text.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+static void run(const BitcoinExchange& base, const std::string& input, int threads, bool together,
+    std::string& out, std::string& err) {
+    BitcoinExchange exchange(base);
+    exchange.setThreadCount(threads);
+    OutputCapture capture(together);
+    exchange.processFile(&input, '|');
+    capture.finish(out, err);
+    ++g_runs;
+}
+
+static void compare(const std::string& what, const std::string& got, const std::string& want) {
+    if (got == want)
+        return;
+    size_t at = 0;
+    while (at < got.size() && at < want.size() && got[at] == want[at])
+        ++at;
+    char where[64];
+    std::sprintf(where, " differs at byte %lu", static_cast<unsigned long>(at));
+    fail(what + where);
+}
+
+int main() {
+    seedRandom((static_cast<uint64_t>(0x5be0cd19u) << 32) | 0x137e2179u);
+    char path[] = "/tmp/thread_test.XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "thread_test: no temporary file" << std::endl;
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    const std::string input(path);
+
+    BitcoinExchange plain("data.csv", ',');
+    BitcoinExchange dense(plain);
+    dense.setDenseLookup(true);
+    dense.setErrorSummary(true);
+    BitcoinExchange fixed(plain);
+    fixed.setFixedPoint(true);
+    fixed.setErrorSummary(true);
+    const BitcoinExchange* modes[] = { &plain, &dense, &fixed };
+    const char* modeNames[] = { "plain", "--dense --summary", "--fixed --summary" };
+    const int threadCounts[] = { 2, 3, 4, 8 };
+
+    // About 2 MB and 7 MB: 16 to 64 chunks, depending on the thread count
+    const size_t lineCounts[] = { 60000, 200000 };
+    for (size_t size = 0; size < 2; ++size) {
+        std::string text = "date | value\n";
+        for (size_t i = 0; i < lineCounts[size]; ++i)
+            text += randomLine() + "\n";
+        // The last line has no newline
+        text += "2012-01-11 | 1";
+        writeFile(input, text);
+        for (size_t m = 0; m < 3; ++m) {
+            for (int together = 0; together < 2; ++together) {
+                std::string serialOut;
+                std::string serialErr;
+                run(*modes[m], input, 1, together != 0, serialOut, serialErr);
+                for (size_t t = 0; t < 4; ++t) {
+                    std::string out;
+                    std::string err;
+                    run(*modes[m], input, threadCounts[t], together != 0, out, err);
+                    char what[128];
+                    std::sprintf(what, "%s -j %d, %lu lines%s", modeNames[m], threadCounts[t],
+                        static_cast<unsigned long>(lineCounts[size]), together ? ", one file" : "");
+                    compare(std::string(what) + ": stdout", out, serialOut);
+                    compare(std::string(what) + ": stderr", err, serialErr);
+                }
+            }
+        }
+    }
+    unlink(path);
+
+    std::cout << "thread_test: " << g_runs << " runs, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,16 +1,140 @@
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
 #include "BitcoinExchange.hpp"
+#include "QueryServer.hpp"
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: ./btc <input_file>" << std::endl;
+static const char* DATABASE = "data.csv";
+static const char* SNAPSHOT = "rates.bin";
+
+static int usage() {
+    std::cerr << "Usage: ./btc [-j threads] [--dense | --sorted] [--summary] [--asset name] [--range | --fixed] [--stats] <input_file>" << std::endl;
+    std::cerr << "       ./btc --compile [database.csv [snapshot.bin]]" << std::endl;
+    std::cerr << "       ./btc --serve [--dense] [--fixed] [--asset name] <socket | ->" << std::endl;
+    std::cerr << "       ./btc --query <socket> [input_file]" << std::endl;
+    return EXIT_FAILURE;
+}
+
+// Parses the CSV database and writes it out as a binary snapshot
+static int compile(int argc, char* argv[]) {
+    if (argc > 4)
+        return usage();
+    const std::string database = argc > 2 ? argv[2] : DATABASE;
+    const std::string snapshot = argc > 3 ? argv[3] : SNAPSHOT;
+    try {
+        BitcoinExchange exchange(database, ',');
+        exchange.saveSnapshot(snapshot);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
+}
+
+// Loads the database once and answers queries until SIGINT/SIGTERM;
+// "-" serves stdin/stdout instead of a Unix socket
+static int serve(int argc, char* argv[]) {
+    bool dense = false;
+    bool fixedPoint = false;
+    std::string asset;
+    int argi = 2;
+    for (; argi < argc - 1; ++argi) {
+        if (std::strcmp(argv[argi], "--dense") == 0)
+            dense = true;
+        else if (std::strcmp(argv[argi], "--fixed") == 0)
+            fixedPoint = true;
+        else if (std::strcmp(argv[argi], "--asset") == 0 && argi + 1 < argc - 1)
+            asset = argv[++argi];
+        else
+            return usage();
+    }
+    if (argi != argc - 1)
+        return usage();
+    try {
+        QueryServer server(DATABASE, SNAPSHOT, dense, fixedPoint, asset);
+        if (std::strcmp(argv[argi], "-") == 0)
+            return server.serveStream(STDIN_FILENO, STDOUT_FILENO);
+        return server.serveSocket(argv[argi]);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+// Sends queries from a file (or stdin) to a running server, prints replies
+static int query(int argc, char* argv[]) {
+    if (argc != 3 && argc != 4)
+        return usage();
+    int in = STDIN_FILENO;
+    if (argc == 4 && (in = open(argv[3], O_RDONLY)) < 0) {
+        std::cerr << "Error: could not open file." << std::endl;
+        return EXIT_FAILURE;
+    }
+    int status = QueryServer::runClient(argv[2], in, STDOUT_FILENO);
+    if (in != STDIN_FILENO)
+        close(in);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::strcmp(argv[1], "--compile") == 0)
+        return compile(argc, argv);
+    if (argc >= 2 && std::strcmp(argv[1], "--serve") == 0)
+        return serve(argc, argv);
+    if (argc >= 2 && std::strcmp(argv[1], "--query") == 0)
+        return query(argc, argv);
+
+    // Options come before the input file, which is always the last argument
+    int threads = 1;
+    bool dense = false;
+    bool sorted = false;
+    bool summary = false;
+    bool ranges = false;
+    bool stats = false;
+    bool fixedPoint = false;
+    std::string asset;
+    int argi = 1;
+    for (; argi < argc - 1; ++argi) {
+        if (std::strcmp(argv[argi], "-j") == 0 && argi + 1 < argc - 1) {
+            char* end;
+            long n = std::strtol(argv[++argi], &end, 10);
+            if (*argv[argi] == '\0' || *end != '\0' || n < 1 || n > 256)
+                return usage();
+            threads = static_cast<int>(n);
+        } else if (std::strcmp(argv[argi], "--dense") == 0) {
+            dense = true;
+        } else if (std::strcmp(argv[argi], "--sorted") == 0) {
+            sorted = true;
+        } else if (std::strcmp(argv[argi], "--summary") == 0) {
+            summary = true;
+        } else if (std::strcmp(argv[argi], "--range") == 0) {
+            ranges = true;
+        } else if (std::strcmp(argv[argi], "--stats") == 0) {
+            stats = true;
+        } else if (std::strcmp(argv[argi], "--fixed") == 0) {
+            fixedPoint = true;
+        } else if (std::strcmp(argv[argi], "--asset") == 0 && argi + 1 < argc - 1) {
+            asset = argv[++argi];
+        } else {
+            return usage();
+        }
+    }
+    if (argc < 2 || argi != argc - 1 || (ranges && fixedPoint) || (dense && sorted))
+        return usage();
 
     try {
-        BitcoinExchange database("data.csv", ',');
-        std::string inputFile = argv[1];
+        BitcoinExchange database(DATABASE, ',', SNAPSHOT);
+        database.setThreadCount(threads);
+        database.setDenseLookup(dense);
+        database.setSortedLookup(sorted);
+        database.setErrorSummary(summary);
+        database.setAsset(asset);
+        database.setRangeQueries(ranges);
+        database.setFixedPoint(fixedPoint);
+        database.setStats(stats);
+        std::string inputFile = argv[argi];
         database.processFile(&inputFile, '|');
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,235 @@
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "BatchEvaluator.hpp"
+#include "OutputBuffer.hpp"
+#include "RPN.hpp"
+
+namespace {
+    const size_t READ_BLOCK = 1 << 20;
+    const size_t NO_NEWLINE = static_cast<size_t>(-1);
+
+    // One block of whole input lines and, once evaluated, its output.
+    // Runs of result and error text are recorded as segments so the two
+    // streams can be replayed in their original order.
+    struct Chunk {
+        struct Segment {
+            bool isError;
+            size_t len;
+        };
+        std::vector<char> input;
+        std::vector<char> text;
+        std::vector<Segment> segments;
+        bool done;
+
+        Chunk() : done(false) {}
+
+        void append(bool isError, const char* data, size_t len) {
+            if (segments.empty() || segments.back().isError != isError) {
+                Segment seg;
+                seg.isError = isError;
+                seg.len = 0;
+                segments.push_back(seg);
+            }
+            text.insert(text.end(), data, data + len);
+            segments.back().len += len;
+        }
+
+        void evaluate(ResultCache* cache) {
+            RPN rpn(cache);
+            const char* p = input.empty() ? NULL : &input[0];
+            const char* const end = p + input.size();
+            while (p < end) {
+                const char* nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+                const char* lineEnd = nl ? nl : end;
+                int result;
+                if (rpn.tryEvaluate(p, static_cast<size_t>(lineEnd - p), result)) {
+                    char buf[INT_TEXT_MAX + 1];
+                    size_t n = formatInt(result, buf);
+                    buf[n++] = '\n';
+                    append(false, buf, n);
+                } else {
+                    append(true, "Error\n", 6);
+                }
+                p = nl ? nl + 1 : end;
+            }
+        }
+
+        void replay(OutputBuffer& out, OutputBuffer& err) const {
+            const char* p = text.empty() ? NULL : &text[0];
+            for (size_t i = 0; i < segments.size(); ++i) {
+                (segments[i].isError ? err : out).write(p, segments[i].len);
+                p += segments[i].len;
+            }
+        }
+    };
+
+    // Reads from fd until input holds at least READ_BLOCK bytes of whole
+    // lines, or the input ends. The partial line after the last newline
+    // is kept in carry for the next chunk.
+    // False once there is nothing left; failed tells a read error from EOF.
+    class ChunkReader {
+    public:
+        explicit ChunkReader(int fd) : _fd(fd), _eof(false), _failed(false) {}
+
+        bool next(std::vector<char>& input) {
+            input.clear();
+            input.swap(_carry);
+            size_t lastNewline = NO_NEWLINE;    // the carry never has one
+            while (!_eof) {
+                const size_t old = input.size();
+                input.resize(old + READ_BLOCK);
+                ssize_t n;
+                do {
+                    n = ::read(_fd, &input[old], READ_BLOCK);
+                } while (n < 0 && errno == EINTR);
+                if (n <= 0) {
+                    input.resize(old);
+                    _eof = true;
+                    _failed = n < 0;
+                    break;
+                }
+                input.resize(old + static_cast<size_t>(n));
+                for (size_t i = input.size(); i > old; --i) {
+                    if (input[i - 1] == '\n') {
+                        lastNewline = i - 1;
+                        break;
+                    }
+                }
+                if (input.size() >= READ_BLOCK && lastNewline != NO_NEWLINE) {
+                    _carry.assign(input.begin() + static_cast<long>(lastNewline) + 1, input.end());
+                    input.resize(lastNewline + 1);
+                    return true;
+                }
+            }
+            return !input.empty();
+        }
+
+        bool failed() const { return _failed; }
+    private:
+        int _fd;
+        bool _eof;
+        bool _failed;
+        std::vector<char> _carry;
+    };
+
+    // Shared state of one parallel run: the chunks read but not yet
+    // written, oldest first
+    struct BatchJob {
+        std::deque<Chunk*> chunks;
+        ResultCache* cache;
+        size_t claimed;     // chunks[0, claimed) are taken by workers
+        bool finished;      // no more chunks will be added
+        pthread_mutex_t lock;
+        pthread_cond_t changed;
+    };
+}
+
+BatchEvaluator::BatchEvaluator(int threads) : _threads(threads < 1 ? 1 : threads), _cache(NULL) {}
+
+BatchEvaluator::~BatchEvaluator() {}
+
+// The cache is not owned and must outlive run(); NULL turns it off
+void BatchEvaluator::setCache(ResultCache* cache) {
+    _cache = cache;
+}
+
+// False if reading the input failed; lines before the failure are answered
+bool BatchEvaluator::run(int in, OutputBuffer& out, OutputBuffer& err) {
+    return _threads > 1 ? runParallel(in, out, err) : runSequential(in, out, err);
+}
+
+bool BatchEvaluator::runSequential(int in, OutputBuffer& out, OutputBuffer& err) {
+    ChunkReader reader(in);
+    Chunk chunk;
+    while (reader.next(chunk.input)) {
+        chunk.text.clear();
+        chunk.segments.clear();
+        chunk.evaluate(_cache);
+        chunk.replay(out, err);
+    }
+    return !reader.failed();
+}
+
+// Takes the oldest unclaimed chunk until the reader is finished
+void* BatchEvaluator::worker(void* arg) {
+    BatchJob& job = *static_cast<BatchJob*>(arg);
+    pthread_mutex_lock(&job.lock);
+    for (;;) {
+        while (job.claimed == job.chunks.size() && !job.finished)
+            pthread_cond_wait(&job.changed, &job.lock);
+        if (job.claimed == job.chunks.size())
+            break;
+        Chunk* chunk = job.chunks[job.claimed++];
+        pthread_mutex_unlock(&job.lock);
+        chunk->evaluate(job.cache);
+        pthread_mutex_lock(&job.lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&job.changed);
+    }
+    pthread_mutex_unlock(&job.lock);
+    return NULL;
+}
+
+// This thread reads chunks and writes finished ones in order; it stops
+// reading while a window of chunks is in flight, which bounds memory.
+// Workers signal each finished chunk, the reader each new one.
+bool BatchEvaluator::runParallel(int in, OutputBuffer& out, OutputBuffer& err) {
+    BatchJob job;
+    job.cache = _cache;
+    job.claimed = 0;
+    job.finished = false;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+    std::vector<pthread_t> threads(static_cast<size_t>(_threads));
+    size_t started = 0;
+    for (; started < threads.size(); ++started) {
+        if (pthread_create(&threads[started], NULL, worker, &job) != 0)
+            break;
+    }
+    if (started == 0) {
+        // No threads available: do the same work on this one
+        pthread_cond_destroy(&job.changed);
+        pthread_mutex_destroy(&job.lock);
+        return runSequential(in, out, err);
+    }
+
+    const size_t window = threads.size() * 4;
+    ChunkReader reader(in);
+    bool reading = true;
+    pthread_mutex_lock(&job.lock);
+    while (reading || !job.chunks.empty()) {
+        if (!job.chunks.empty() && job.chunks.front()->done) {
+            Chunk* chunk = job.chunks.front();
+            job.chunks.pop_front();
+            --job.claimed;
+            pthread_mutex_unlock(&job.lock);
+            chunk->replay(out, err);
+            delete chunk;
+            pthread_mutex_lock(&job.lock);
+        } else if (reading && job.chunks.size() < window) {
+            pthread_mutex_unlock(&job.lock);
+            Chunk* chunk = new Chunk;
+            reading = reader.next(chunk->input);
+            pthread_mutex_lock(&job.lock);
+            if (reading)
+                job.chunks.push_back(chunk);
+            else {
+                delete chunk;
+                job.finished = true;
+            }
+            pthread_cond_broadcast(&job.changed);
+        } else {
+            pthread_cond_wait(&job.changed, &job.lock);
+        }
+    }
+    pthread_mutex_unlock(&job.lock);
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&job.changed);
+    pthread_mutex_destroy(&job.lock);
+    return !reader.failed();
+}
@@ -0,0 +1,33 @@
+#ifndef BATCHEVALUATOR_HPP
+#define BATCHEVALUATOR_HPP
+
+class OutputBuffer;
+class ResultCache;
+
+// Evaluates newline-separated expressions read from a file descriptor,
+// answering each line as RPN does a single expression: the result on the
+// output stream, or "Error" on the error stream.
+// Input is read in large blocks and cut into chunks at line boundaries.
+// With more than one thread the chunks are evaluated concurrently while
+// this thread keeps reading, and every chunk's lines are written out in
+// input order, so the output is the same as a sequential run.
+// With setCache, all threads look up and record outcomes in one cache.
+class BatchEvaluator {
+public:
+    explicit BatchEvaluator(int threads);
+    ~BatchEvaluator();
+
+    void setCache(ResultCache* cache);
+    bool run(int in, OutputBuffer& out, OutputBuffer& err);
+private:
+    bool runSequential(int in, OutputBuffer& out, OutputBuffer& err);
+    bool runParallel(int in, OutputBuffer& out, OutputBuffer& err);
+    static void* worker(void* arg);
+    BatchEvaluator();
+    BatchEvaluator(const BatchEvaluator& other);
+    BatchEvaluator& operator=(const BatchEvaluator& other);
+    int _threads;
+    ResultCache* _cache;
+};
+
+#endif // BATCHEVALUATOR_HPP
@@ -0,0 +1,239 @@
+// Throughput benchmark for the RPN evaluators. Prints one JSON object per
+// run so results can be appended to a file and compared across versions.
+//
+//   rpn_bench <input_file> [--mode evaluate|try|program|cache|batch|parallel]
+//             [-j threads] [--cache bytes] [--label text]
+//
+// Every mode but batch takes the lines from memory, one call per line;
+// batch reads the file itself and writes to /dev/null.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "BatchEvaluator.hpp"
+#include "OutputBuffer.hpp"
+#include "ParallelEvaluator.hpp"
+#include "RPN.hpp"
+#include "RPNProgram.hpp"
+#include "ResultCache.hpp"
+
+// Every allocation in the process comes through here, so a run can report
+// how many it made per expression
+static unsigned long g_allocations = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+    __sync_add_and_fetch(&g_allocations, 1);
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc) {
+    return operator new(size);
+}
+
+void operator delete(void* p) throw() {
+    std::free(p);
+}
+
+void operator delete[](void* p) throw() {
+    std::free(p);
+}
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// The input file split into lines, without their newlines
+struct Lines {
+    std::vector<char> text;
+    std::vector<size_t> starts;     // one per line, plus the end
+    unsigned long tokens;
+
+    bool load(const char* path) {
+        std::FILE* f = std::fopen(path, "rb");
+        if (!f)
+            return false;
+        char buf[1 << 16];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+            text.insert(text.end(), buf, buf + n);
+        std::fclose(f);
+        if (!text.empty() && text.back() != '\n')
+            text.push_back('\n');
+        tokens = 0;
+        bool inToken = false;
+        starts.push_back(0);
+        for (size_t i = 0; i < text.size(); ++i) {
+            const char c = text[i];
+            const bool space = c == ' ' || (c >= '\t' && c <= '\r');
+            tokens += !space && !inToken;
+            inToken = !space;
+            if (c == '\n')
+                starts.push_back(i + 1);
+        }
+        return true;
+    }
+
+    size_t count() const { return starts.size() - 1; }
+    const char* line(size_t i) const { return &text[starts[i]]; }
+    size_t length(size_t i) const { return starts[i + 1] - starts[i] - 1; }
+};
+
+struct Totals {
+    unsigned long errors;
+    long checksum;
+};
+
+static void add(Totals& totals, bool ok, int result) {
+    if (ok)
+        totals.checksum += result;
+    else
+        ++totals.errors;
+}
+
+static void runEvaluate(const Lines& lines, Totals& totals) {
+    RPN rpn;
+    for (size_t i = 0; i < lines.count(); ++i) {
+        try {
+            add(totals, true, rpn.evaluate(std::string(lines.line(i), lines.length(i))));
+        } catch (const std::exception&) {
+            add(totals, false, 0);
+        }
+    }
+}
+
+static void runTry(const Lines& lines, RPN& rpn, Totals& totals) {
+    for (size_t i = 0; i < lines.count(); ++i) {
+        int result = 0;
+        const bool ok = rpn.tryEvaluate(lines.line(i), lines.length(i), result);
+        add(totals, ok, result);
+    }
+}
+
+static void runProgram(const Lines& lines, Totals& totals) {
+    for (size_t i = 0; i < lines.count(); ++i) {
+        try {
+            RPNProgram program(std::string(lines.line(i), lines.length(i)));
+            add(totals, true, program.run());
+        } catch (const std::exception&) {
+            add(totals, false, 0);
+        }
+    }
+}
+
+static void runParallel(const Lines& lines, int threads, Totals& totals) {
+    ParallelEvaluator evaluator(threads);
+    for (size_t i = 0; i < lines.count(); ++i) {
+        int result = 0;
+        const bool ok = evaluator.tryEvaluate(lines.line(i), lines.length(i), result);
+        add(totals, ok, result);
+    }
+}
+
+static bool runBatch(const char* path, int threads, ResultCache* cache) {
+    const int in = open(path, O_RDONLY);
+    const int null = open("/dev/null", O_WRONLY);
+    bool ok = in >= 0 && null >= 0;
+    if (ok) {
+        OutputBuffer out(null);
+        OutputBuffer err(null, 1 << 16);
+        BatchEvaluator evaluator(threads);
+        evaluator.setCache(cache);
+        ok = evaluator.run(in, out, err);
+    }
+    if (in >= 0)
+        close(in);
+    if (null >= 0)
+        close(null);
+    return ok;
+}
+
+static int usage() {
+    std::cerr << "Usage: ./rpn_bench <input_file> [--mode evaluate|try|program|cache|batch|parallel]"
+        " [-j threads] [--cache bytes] [--label text]" << std::endl;
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2)
+        return usage();
+    const char* const input = argv[1];
+    std::string mode = "evaluate";
+    int threads = 1;
+    long cacheBytes = 64L << 20;
+    std::string label;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+            mode = argv[++i];
+        else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cacheBytes = std::atol(argv[++i]);
+        else if (std::strcmp(argv[i], "--label") == 0 && i + 1 < argc)
+            label = argv[++i];
+        else
+            return usage();
+    }
+    if (threads < 1 || threads > 256 || cacheBytes < 0)
+        return usage();
+    if (mode != "evaluate" && mode != "try" && mode != "program" && mode != "cache" && mode != "batch"
+        && mode != "parallel")
+        return usage();
+    Lines lines;
+    if (!lines.load(input)) {
+        std::cerr << "Error: could not read " << input << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const bool cached = mode == "cache" || (mode == "batch" && cacheBytes > 0);
+    ResultCache cache(cached ? static_cast<size_t>(cacheBytes) : 0);
+    RPN rpn(cached ? &cache : NULL);
+    Totals totals = Totals();
+    const unsigned long allocationsBefore = __sync_add_and_fetch(&g_allocations, 0);
+    const double start = now();
+    if (mode == "evaluate")
+        runEvaluate(lines, totals);
+    else if (mode == "try" || mode == "cache")
+        runTry(lines, rpn, totals);
+    else if (mode == "program")
+        runProgram(lines, totals);
+    else if (mode == "parallel")
+        runParallel(lines, threads, totals);
+    else if (!runBatch(input, threads, cached ? &cache : NULL)) {
+        std::cerr << "Error: could not run " << input << std::endl;
+        return EXIT_FAILURE;
+    }
+    const double seconds = now() - start;
+    const unsigned long allocations = __sync_add_and_fetch(&g_allocations, 0) - allocationsBefore;
+
+    const double exprs = static_cast<double>(lines.count());
+    std::printf("{\"label\":\"%s\",\"input\":\"%s\",\"mode\":\"%s\",\"threads\":%d,\"cache_bytes\":%ld,",
+        label.c_str(), input, mode.c_str(), threads, cached ? cacheBytes : 0L);
+    std::printf("\"exprs\":%lu,\"tokens\":%lu,\"ms\":%.3f,\"exprs_per_sec\":%.0f,\"tokens_per_sec\":%.0f,",
+        static_cast<unsigned long>(lines.count()), lines.tokens, seconds * 1e3,
+        seconds > 0 ? exprs / seconds : 0.0, seconds > 0 ? lines.tokens / seconds : 0.0);
+    std::printf("\"allocs_per_expr\":%.3f,", exprs > 0 ? allocations / exprs : 0.0);
+    if (cached) {
+        const ResultCache::Stats stats = cache.stats();
+        std::printf("\"cache\":{\"hits\":%lu,\"misses\":%lu,\"evictions\":%lu,\"entries\":%lu,\"bytes\":%lu},",
+            static_cast<unsigned long>(stats.hits), static_cast<unsigned long>(stats.misses),
+            static_cast<unsigned long>(stats.evictions), static_cast<unsigned long>(stats.entries),
+            static_cast<unsigned long>(stats.bytes));
+    }
+    if (mode == "batch")
+        std::printf("\"errors\":null,\"checksum\":null}\n");
+    else
+        std::printf("\"errors\":%lu,\"checksum\":%ld}\n", totals.errors, totals.checksum);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+// Differential fuzzer: every way ex01 can evaluate an expression, checked
+// against RPN::evaluate on the exact text each would print ("<result>" or
+// "Error"). Random expressions mix valid trees, overflow, division by zero
+// and malformed tokens, spaced with every whitespace character.
+//
+//   fuzz_test [expressions] [seed]
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include "BatchEvaluator.hpp"
+#include "OutputBuffer.hpp"
+#include "ParallelEvaluator.hpp"
+#include "RPN.hpp"
+#include "RPNProgram.hpp"
+#include "ResultCache.hpp"
+
+static uint64_t g_seed = (static_cast<uint64_t>(0xbb67ae85u) << 32) | 0x84caa73bu;
+
+static uint64_t nextRandom() {
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return g_seed;
+}
+
+static size_t below(size_t n) {
+    return static_cast<size_t>(nextRandom() % n);
+}
+
+static int g_failures = 0;
+
+static void fail(const std::string& mode, const std::string& expr, const std::string& got, const std::string& want) {
+    if (g_failures++ < 20) {
+        std::cerr << mode << ": \"" << (expr.size() > 200 ? expr.substr(0, 200) + "..." : expr) << "\" gave "
+            << got << ", want " << want << std::endl;
+    }
+}
+
+static std::string textOf(int value) {
+    std::ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+
+static std::string textOf(bool ok, int value) {
+    return ok ? textOf(value) : "Error";
+}
+
+// What ./RPN prints for expr
+static std::string reference(const std::string& expr) {
+    RPN rpn;
+    try {
+        return textOf(rpn.evaluate(expr));
+    } catch (const std::exception&) {
+        return "Error";
+    }
+}
+
+// Operand digits, picked so that overflow and division by zero are common
+// without drowning out the valid cases
+static char randomDigit() {
+    static const char DIGITS[] = "01234567899999";
+    return DIGITS[below(sizeof(DIGITS) - 1)];
+}
+
+static const char* const BAD_TOKENS[] = { "12", "-1", "+-", "x", "(", "$0", "$", "1.", "\x80", "#" };
+
+// Postfix tokens of a random tree, the last operand placeholders
+// $0..$slots-1 with the given chance, then possibly broken
+static std::vector<std::string> randomTokens(size_t operands, const std::string& operators, size_t slots = 0) {
+    std::vector<std::string> tokens;
+    size_t pushed = 0;
+    size_t depth = 0;
+    while (pushed < operands || depth > 1) {
+        if (pushed < operands && (depth < 2 || below(2) == 0)) {
+            if (slots && below(3) == 0)
+                tokens.push_back("$" + textOf(static_cast<int>(below(slots))));
+            else
+                tokens.push_back(std::string(1, randomDigit()));
+            ++pushed;
+            ++depth;
+        } else {
+            tokens.push_back(std::string(1, operators[below(operators.size())]));
+            --depth;
+        }
+    }
+    if (slots == 0 && below(5) == 0) {
+        switch (below(4)) {
+            case 0: tokens[below(tokens.size())] = BAD_TOKENS[below(sizeof(BAD_TOKENS) / sizeof(BAD_TOKENS[0]))]; break;
+            case 1: tokens.erase(tokens.begin() + static_cast<long>(below(tokens.size()))); break;
+            case 2: tokens.insert(tokens.begin() + static_cast<long>(below(tokens.size() + 1)), "+"); break;
+            default: tokens.push_back(std::string(1, randomDigit())); break;
+        }
+    }
+    return tokens;
+}
+
+// Joins tokens with one space, or with runs of any whitespace; newlines
+// only when the expression is not meant to be a line of its own
+static std::string join(const std::vector<std::string>& tokens, bool messy, bool newlines) {
+    static const char SPACES[] = " \t\v\f\r\n";
+    const size_t kinds = newlines ? 6 : 5;
+    std::string text;
+    for (size_t i = 0; i <= tokens.size(); ++i) {
+        if (messy) {
+            for (size_t n = below(3); n > 0; --n)
+                text += SPACES[below(kinds)];
+        }
+        if (i == tokens.size())
+            break;
+        if (i > 0)
+            text += ' ';
+        text += tokens[i];
+    }
+    return text;
+}
+
+static std::string randomOperators() {
+    static const char* const MIXES[] = { "+-*/", "+-", "*", "/", "+-*", "*/", "-" };
+    return MIXES[below(sizeof(MIXES) / sizeof(MIXES[0]))];
+}
+
+// RPN::tryEvaluate, RPN through a small shared cache (twice, so the second
+// answer comes from the cache), RPNProgram and ParallelEvaluator
+static void checkExpression(const std::string& expr, RPN& cached, const ParallelEvaluator& parallel) {
+    const std::string want = reference(expr);
+    RPN rpn;
+    int value = 0;
+    bool ok = rpn.tryEvaluate(expr.data(), expr.size(), value);
+    if (textOf(ok, value) != want)
+        fail("tryEvaluate", expr, textOf(ok, value), want);
+    for (int pass = 0; pass < 2; ++pass) {
+        value = 0;
+        ok = cached.tryEvaluate(expr.data(), expr.size(), value);
+        if (textOf(ok, value) != want)
+            fail(pass ? "cache hit" : "cache", expr, textOf(ok, value), want);
+    }
+    std::string got;
+    try {
+        RPNProgram program(expr);
+        got = textOf(program.run());
+    } catch (const std::exception&) {
+        got = "Error";
+    }
+    if (got != want)
+        fail("RPNProgram", expr, got, want);
+    value = 0;
+    ok = parallel.tryEvaluate(expr.data(), expr.size(), value);
+    if (textOf(ok, value) != want)
+        fail("ParallelEvaluator", expr, textOf(ok, value), want);
+}
+
+// BatchEvaluator over the lines, results and errors written to one file
+// the way "./RPN --batch file 2>&1" interleaves them
+static void checkBatch(const std::vector<std::string>& lines, int threads, ResultCache* cache) {
+    char inPath[] = "/tmp/fuzz_test_in.XXXXXX";
+    char outPath[] = "/tmp/fuzz_test_out.XXXXXX";
+    const int in = mkstemp(inPath);
+    const int out = mkstemp(outPath);
+    if (in < 0 || out < 0) {
+        fail("batch", "", "no temporary file", "one");
+        return;
+    }
+    std::string input;
+    std::string want;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        input += lines[i] + "\n";
+        want += reference(lines[i]) + "\n";
+    }
+    bool ok = write(in, input.data(), input.size()) == static_cast<ssize_t>(input.size())
+        && lseek(in, 0, SEEK_SET) == 0;
+    if (ok) {
+        OutputBuffer results(out);
+        OutputBuffer errors(out, 1 << 16);
+        results.tie(&errors);
+        errors.tie(&results);
+        BatchEvaluator evaluator(threads);
+        evaluator.setCache(cache);
+        ok = evaluator.run(in, results, errors);
+    }
+    std::string got;
+    char buf[1 << 16];
+    ssize_t n;
+    lseek(out, 0, SEEK_SET);
+    while ((n = read(out, buf, sizeof(buf))) > 0)
+        got.append(buf, static_cast<size_t>(n));
+    close(in);
+    close(out);
+    unlink(inPath);
+    unlink(outPath);
+    if (!ok || got != want) {
+        size_t line = 0;
+        for (size_t i = 0; i < got.size() && i < want.size() && got[i] == want[i]; ++i)
+            line += got[i] == '\n';
+        fail("batch -j " + textOf(threads) + (cache ? " cached" : ""), line < lines.size() ? lines[line] : "",
+            "different output from line " + textOf(static_cast<int>(line) + 1), "the same");
+    }
+}
+
+// Any int, mostly near the edges of the checked arithmetic
+static int randomInt() {
+    static const int EDGES[] = { 0, 1, -1, 2, -2, 46340, -46340, 46341, -46341, 65536, -65536,
+        INT_MAX, INT_MIN, INT_MAX - 1, INT_MIN + 1, INT_MAX / 2, INT_MIN / 2 };
+    switch (below(3)) {
+        case 0: return EDGES[below(sizeof(EDGES) / sizeof(EDGES[0]))];
+        case 1: return static_cast<int>(below(2001)) - 1000;
+        default: return static_cast<int>(static_cast<uint32_t>(nextRandom()));
+    }
+}
+
+// RPNProgram::runColumns over random operand columns. Digit columns are
+// checked against the expression with each row's digits written in; any
+// other ints, which no expression can spell, against RPNProgram::run.
+static void checkColumns(size_t rows, bool digits) {
+    const size_t slots = 1 + below(4);
+    std::vector<std::string> tokens = randomTokens(1 + below(12), randomOperators(), slots);
+    std::vector<std::vector<int> > columns(slots, std::vector<int>(rows));
+    std::vector<const int*> pointers(slots);
+    for (size_t s = 0; s < slots; ++s) {
+        for (size_t r = 0; r < rows; ++r)
+            columns[s][r] = digits ? randomDigit() - '0' : randomInt();
+        pointers[s] = &columns[s][0];
+    }
+    RPNProgram program(join(tokens, false, false));
+    RPNProgram scalar(program);
+    std::vector<int> results(rows);
+    std::vector<unsigned char> errors(rows);
+    program.runColumns(&pointers[0], slots, rows, &results[0], &errors[0]);
+    for (size_t r = 0; r < rows; ++r) {
+        std::vector<std::string> bound(tokens);
+        std::vector<int> args(slots);
+        for (size_t s = 0; s < slots; ++s)
+            args[s] = columns[s][r];
+        for (size_t k = 0; k < bound.size(); ++k) {
+            if (bound[k][0] == '$')
+                bound[k] = textOf(columns[std::atoi(bound[k].c_str() + 1)][r]);
+        }
+        const std::string expr = join(bound, false, false);
+        std::string want;
+        if (digits) {
+            want = reference(expr);
+        } else {
+            try {
+                want = textOf(scalar.run(&args[0], slots));
+            } catch (const std::exception&) {
+                want = "Error";
+            }
+        }
+        const std::string got = textOf(!errors[r], results[r]);
+        if (got != want)
+            fail("runColumns row " + textOf(static_cast<int>(r)), expr, got, want);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const long count = argc > 1 ? std::atol(argv[1]) : 20000;
+    if (argc > 2)
+        g_seed += static_cast<uint64_t>(std::atol(argv[2]));
+    if (argc > 3 || count < 0) {
+        std::cerr << "Usage: ./fuzz_test [expressions] [seed]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ResultCache cache(1 << 14);
+    RPN cached(&cache);
+    ParallelEvaluator parallel(3);
+    std::vector<std::string> lines;
+    for (long i = 0; i < count; ++i) {
+        const size_t operands = below(10) == 0 ? 1 + below(400) : 1 + below(12);
+        const std::vector<std::string> tokens = randomTokens(operands, randomOperators());
+        const std::string expr = join(tokens, below(2) == 0, true);
+        checkExpression(expr, cached, parallel);
+        lines.push_back(join(tokens, below(2) == 0, false));
+    }
+    lines.push_back("");
+    for (int threads = 1; threads <= 4; threads += 3) {
+        checkBatch(lines, threads, NULL);
+        checkBatch(lines, threads, &cache);
+    }
+
+    // Expressions big enough for ParallelEvaluator to split
+    long big = 0;
+    for (; big < 12; ++big) {
+        const std::string operators = big % 3 == 0 ? "+-*/" : "+-";
+        const std::string expr = join(randomTokens(40000 + below(200000), operators), big % 2 == 0, true);
+        checkExpression(expr, cached, parallel);
+    }
+
+    long columnRows = 0;
+    for (int i = 0; i < 400; ++i) {
+        const size_t rows = 1 + below(600);
+        checkColumns(rows, i % 2 == 0);
+        columnRows += static_cast<long>(rows);
+    }
+
+    std::cout << "fuzz_test: " << count + big << " expressions, " << lines.size() << " batch lines, "
+        << columnRows << " column rows, " << g_failures << " mismatches" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
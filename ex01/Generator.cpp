@@ -0,0 +1,106 @@
+// Synthetic input for the RPN benchmark.
+//
+//   rpn_gen <lines> <out.txt> [tokens] [operators] [error_ratio] [seed]
+//       One expression per line, each a random tree of the given number of
+//       tokens (default 15; even counts get one more).
+//       operators:   the operators drawn from, a repeated one more often
+//                    (default "+-*/"); with only "+-" almost every
+//                    well-formed line evaluates, "*" and "/" bring
+//                    overflow and division by zero
+//       error_ratio: share of malformed lines, 0.0 .. 1.0
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+static uint64_t g_state = 0x9e3779b9u;
+
+static uint64_t nextRandom() {
+    g_state ^= g_state << 13;
+    g_state ^= g_state >> 7;
+    g_state ^= g_state << 17;
+    return g_state;
+}
+
+static double randomUnit() {
+    return static_cast<double>(nextRandom() >> 11) / 9007199254740992.0;
+}
+
+// Postfix tokens of a random tree with the given number of operands: a
+// digit whenever the stack is short, otherwise a coin flip while digits
+// remain
+static std::string randomTokens(size_t operands, const std::string& operators) {
+    std::string tokens;
+    tokens.reserve(operands * 2);
+    size_t pushed = 0;
+    size_t depth = 0;
+    while (pushed < operands || depth > 1) {
+        if (pushed < operands && (depth < 2 || nextRandom() % 2 == 0)) {
+            tokens += static_cast<char>('0' + nextRandom() % 10);
+            ++pushed;
+            ++depth;
+        } else {
+            tokens += operators[nextRandom() % operators.size()];
+            --depth;
+        }
+    }
+    return tokens;
+}
+
+// Breaks the expression, cycling through the ways RPN rejects input;
+// glued is set to a token written without the space before it
+static std::string malformed(std::string tokens, size_t& glued) {
+    switch (nextRandom() % 5) {
+        case 0: tokens[nextRandom() % tokens.size()] = "x(."[nextRandom() % 3]; break;
+        case 1: tokens.erase(tokens.size() - 1); break;
+        case 2: tokens.insert(tokens.begin(), '+'); break;
+        case 3: tokens += static_cast<char>('0' + nextRandom() % 10); break;
+        default:
+            tokens.insert(tokens.begin(), static_cast<char>('1' + nextRandom() % 9));
+            glued = 1;
+            break;
+    }
+    return tokens;
+}
+
+static int generate(long lines, const char* path, size_t tokenCount, const std::string& operators, double errorRatio) {
+    std::FILE* f = std::fopen(path, "w");
+    if (!f)
+        return EXIT_FAILURE;
+    std::string line;
+    for (long i = 0; i < lines; ++i) {
+        std::string tokens = randomTokens((tokenCount + 1) / 2, operators);
+        size_t glued = 0;
+        if (randomUnit() < errorRatio)
+            tokens = malformed(tokens, glued);
+        line.clear();
+        for (size_t k = 0; k < tokens.size(); ++k) {
+            if (k && k != glued)
+                line += ' ';
+            line += tokens[k];
+        }
+        line += '\n';
+        std::fputs(line.c_str(), f);
+    }
+    return std::fclose(f) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int usage() {
+    std::fprintf(stderr, "Usage: ./rpn_gen <lines> <out.txt> [tokens] [operators] [error_ratio] [seed]\n");
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 7)
+        return usage();
+    const long lines = std::atol(argv[1]);
+    const long tokens = argc > 3 ? std::atol(argv[3]) : 15;
+    const std::string operators = argc > 4 ? argv[4] : "+-*/";
+    const double errorRatio = argc > 5 ? std::atof(argv[5]) : 0.0;
+    if (argc > 6)
+        g_state += static_cast<uint64_t>(std::atol(argv[6]));
+    if (lines < 0 || tokens < 1 || operators.empty() || operators.find_first_not_of("+-*/") != std::string::npos)
+        return usage();
+    return generate(lines, argv[2], static_cast<size_t>(tokens), operators, errorRatio);
+}
@@ -0,0 +1,20 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <stdint.h>
+
+// 64-bit FNV-1a, used to key the result cache
+static const uint64_t FNV_OFFSET = (static_cast<uint64_t>(0xcbf29ce4) << 32) | 0x84222325;
+static const uint64_t FNV_PRIME = (static_cast<uint64_t>(0x00000100) << 32) | 0x000001b3;
+
+inline uint64_t fnv1a(const void* data, size_t len, uint64_t hash = FNV_OFFSET) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+#endif // HASH_HPP
@@ -0,0 +1,135 @@
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+#include "LaneMath.hpp"
+#include "SafeMath.hpp"
+
+#if defined(__SSE2__)
+
+static inline __m128i load(const int* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+static inline void store(int* p, __m128i v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+// Lanes 0-1 and 2-3 as doubles, which hold any int and any product or
+// quotient of two ints exactly enough to decide overflow
+static inline __m128d lowPair(__m128i v) {
+    return _mm_cvtepi32_pd(v);
+}
+
+static inline __m128d highPair(__m128i v) {
+    return _mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+// Two 64-bit compare masks back to four 32-bit ones
+static inline __m128i packMasks(__m128d low, __m128d high) {
+    return _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(low), _mm_castpd_ps(high), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+// Truncates two pairs of doubles, all in int range, back into one vector
+static inline __m128i packInts(__m128d low, __m128d high) {
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(low), _mm_cvttpd_epi32(high));
+}
+
+// Wrapped sum; it overflowed where both inputs differ in sign from it
+void addLanes(int* a, const int* b, int* err, size_t lanes) {
+    for (size_t i = 0; i < lanes; i += LANE_WIDTH) {
+        const __m128i x = load(a + i);
+        const __m128i y = load(b + i);
+        const __m128i r = _mm_add_epi32(x, y);
+        const __m128i bad = _mm_srai_epi32(_mm_and_si128(_mm_xor_si128(x, r), _mm_xor_si128(y, r)), 31);
+        store(a + i, r);
+        store(err + i, _mm_or_si128(load(err + i), bad));
+    }
+}
+
+// Wrapped difference; it overflowed where the inputs differ in sign and
+// the result differs from a
+void subLanes(int* a, const int* b, int* err, size_t lanes) {
+    for (size_t i = 0; i < lanes; i += LANE_WIDTH) {
+        const __m128i x = load(a + i);
+        const __m128i y = load(b + i);
+        const __m128i r = _mm_sub_epi32(x, y);
+        const __m128i bad = _mm_srai_epi32(_mm_and_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, r)), 31);
+        store(a + i, r);
+        store(err + i, _mm_or_si128(load(err + i), bad));
+    }
+}
+
+// The product in double is exact while it is near the int range, so
+// |p| > INT_MAX decides overflow as safe_mul does; -2^31 is allowed only
+// when one side is 1
+void mulLanes(int* a, const int* b, int* err, size_t lanes) {
+    const __m128d limit = _mm_set1_pd(2147483647.0);
+    const __m128d minimum = _mm_set1_pd(-2147483648.0);
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128i one = _mm_set1_epi32(1);
+    for (size_t i = 0; i < lanes; i += LANE_WIDTH) {
+        const __m128i x = load(a + i);
+        const __m128i y = load(b + i);
+        const __m128d low = _mm_mul_pd(lowPair(x), lowPair(y));
+        const __m128d high = _mm_mul_pd(highPair(x), highPair(y));
+        const __m128i over = packMasks(_mm_cmpgt_pd(_mm_andnot_pd(sign, low), limit),
+            _mm_cmpgt_pd(_mm_andnot_pd(sign, high), limit));
+        const __m128i isMin = packMasks(_mm_cmpeq_pd(low, minimum), _mm_cmpeq_pd(high, minimum));
+        const __m128i byOne = _mm_or_si128(_mm_cmpeq_epi32(x, one), _mm_cmpeq_epi32(y, one));
+        const __m128i bad = _mm_andnot_si128(_mm_and_si128(isMin, byOne), over);
+        store(a + i, packInts(low, high));
+        store(err + i, _mm_or_si128(load(err + i), bad));
+    }
+}
+
+// Failing lanes divide by 1 instead; for the rest, truncating the double
+// quotient of two ints gives exactly the int quotient
+void divLanes(int* a, const int* b, int* err, size_t lanes) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    const __m128i intMin = _mm_set1_epi32(INT_MIN);
+    for (size_t i = 0; i < lanes; i += LANE_WIDTH) {
+        const __m128i x = load(a + i);
+        __m128i y = load(b + i);
+        const __m128i bad = _mm_or_si128(_mm_cmpeq_epi32(y, zero),
+            _mm_and_si128(_mm_cmpeq_epi32(x, intMin), _mm_cmpeq_epi32(y, minusOne)));
+        y = _mm_or_si128(_mm_andnot_si128(bad, y), _mm_and_si128(bad, one));
+        const __m128d low = _mm_div_pd(lowPair(x), lowPair(y));
+        const __m128d high = _mm_div_pd(highPair(x), highPair(y));
+        store(a + i, packInts(low, high));
+        store(err + i, _mm_or_si128(load(err + i), bad));
+    }
+}
+
+#else
+
+void addLanes(int* a, const int* b, int* err, size_t lanes) {
+    for (size_t i = 0; i < lanes; ++i) {
+        if (!safe_add(a[i], b[i], a[i]))
+            err[i] = -1;
+    }
+}
+
+void subLanes(int* a, const int* b, int* err, size_t lanes) {
+    for (size_t i = 0; i < lanes; ++i) {
+        if (!safe_sub(a[i], b[i], a[i]))
+            err[i] = -1;
+    }
+}
+
+void mulLanes(int* a, const int* b, int* err, size_t lanes) {
+    for (size_t i = 0; i < lanes; ++i) {
+        if (!safe_mul(a[i], b[i], a[i]))
+            err[i] = -1;
+    }
+}
+
+void divLanes(int* a, const int* b, int* err, size_t lanes) {
+    for (size_t i = 0; i < lanes; ++i) {
+        if (!safe_div(a[i], b[i], a[i]))
+            err[i] = -1;
+    }
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef LANEMATH_HPP
+#define LANEMATH_HPP
+
+#include <cstddef>
+
+// The SafeMath checks over arrays of lanes: a[i] = a[i] op b[i] for
+// every i < lanes, with err[i] set to -1 where safe_* would fail and left
+// alone elsewhere. What a lane holds after it failed is unspecified.
+// lanes must be a multiple of LANE_WIDTH; the arrays need no alignment.
+// Uses SSE2 where the compiler targets it, plain loops otherwise.
+
+static const size_t LANE_WIDTH = 4;
+
+void addLanes(int* a, const int* b, int* err, size_t lanes);
+void subLanes(int* a, const int* b, int* err, size_t lanes);
+void mulLanes(int* a, const int* b, int* err, size_t lanes);
+void divLanes(int* a, const int* b, int* err, size_t lanes);
+
+#endif // LANEMATH_HPP
@@ -0,0 +1,83 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "OutputBuffer.hpp"
+
+static void writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+}
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity)
+    : _fd(fd), _buf(capacity < INT_TEXT_MAX ? INT_TEXT_MAX : capacity), _used(0), _tied(NULL) {}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+// True when both descriptors write to the same file, pipe or terminal
+bool OutputBuffer::sameTarget(int fd1, int fd2) {
+    struct stat st1;
+    struct stat st2;
+    if (fstat(fd1, &st1) != 0 || fstat(fd2, &st2) != 0)
+        return true;
+    return st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+}
+
+void OutputBuffer::tie(OutputBuffer* other) {
+    _tied = other;
+}
+
+void OutputBuffer::flush() {
+    writeAll(_fd, &_buf[0], _used);
+    _used = 0;
+}
+
+void OutputBuffer::reserve(size_t len) {
+    if (_tied && _tied->_used)
+        _tied->flush();
+    if (_buf.size() - _used < len)
+        flush();
+}
+
+void OutputBuffer::write(const char* data, size_t len) {
+    reserve(len);
+    if (len > _buf.size()) {
+        writeAll(_fd, data, len);
+        return;
+    }
+    std::memcpy(&_buf[_used], data, len);
+    _used += len;
+}
+
+void OutputBuffer::put(char c) {
+    reserve(1);
+    _buf[_used++] = c;
+}
+
+size_t formatInt(int value, char* out) {
+    // INT_MIN の絶対値は int に収まらないので unsigned で扱う
+    unsigned magnitude = value < 0 ? 0u - static_cast<unsigned>(value) : static_cast<unsigned>(value);
+    char digits[INT_TEXT_MAX];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    size_t n = 0;
+    if (value < 0)
+        out[n++] = '-';
+    while (count)
+        out[n++] = digits[--count];
+    return n;
+}
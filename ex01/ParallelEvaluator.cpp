@@ -0,0 +1,261 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "ParallelEvaluator.hpp"
+#include "RPN.hpp"
+#include "SafeMath.hpp"
+
+namespace {
+    // Shorter expressions are left to RPN: building the tree costs about
+    // as much as evaluating
+    const size_t PARALLEL_MIN_LEN = 1 << 16;
+    // Tasks aimed for per thread, so that stealing can even out the load
+    const size_t TASKS_PER_THREAD = 8;
+    const size_t MIN_GRAIN = 1 << 12;
+    // Subtrees under grain / MIN_TASK_SHARE are left to the last pass
+    const size_t MIN_TASK_SHARE = 16;
+    const size_t MAX_TOKENS = static_cast<uint32_t>(-1);
+
+    enum { TOKEN_ADD = 10, TOKEN_SUB, TOKEN_MUL, TOKEN_DIV };
+
+    // The characters std::istream skips between tokens in the "C" locale
+    inline bool isSpace(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    // A subtree evaluated on its own: tokens [first, last]
+    struct Task {
+        uint32_t first;
+        uint32_t last;
+        int value;
+    };
+
+    // The checked tokens of an expression: code[k] is a digit's value or
+    // a TOKEN_* operator, start[k] the first token of k's subtree
+    struct Tree {
+        std::vector<unsigned char> code;
+        std::vector<uint32_t> start;
+
+        bool build(const char* expr, size_t len);
+        void split(size_t grain, std::vector<Task>& tasks) const;
+    };
+
+    // False for anything RPN rejects before doing arithmetic: the same
+    // one-byte tokens, and an operator needs two subtrees to join.
+    // The arrays are sized for the most tokens len can hold and filled
+    // through pointers, which keeps this pass close to RPN's own speed.
+    bool Tree::build(const char* expr, size_t len) {
+        const size_t most = (len + 1) / 2;
+        code.resize(most);
+        start.resize(most);
+        std::vector<uint32_t> stack(most);  // roots of the subtrees on the stack
+        unsigned char* const c0 = &code[0];
+        uint32_t* const s0 = &start[0];
+        uint32_t* const r0 = &stack[0];
+        uint32_t* roots = r0;
+        uint32_t k = 0;
+        const char* p = expr;
+        const char* const end = expr + len;
+        while (p < end) {
+            const char c = *p++;
+            if (isSpace(c))
+                continue;
+            if (p < end && !isSpace(*p))
+                return false;
+            if (c >= '0' && c <= '9') {
+                c0[k] = static_cast<unsigned char>(c - '0');
+                s0[k] = k;
+                *roots++ = k++;
+                continue;
+            }
+            unsigned char op;
+            switch (c) {
+            case '+': op = TOKEN_ADD; break;
+            case '-': op = TOKEN_SUB; break;
+            case '*': op = TOKEN_MUL; break;
+            case '/': op = TOKEN_DIV; break;
+            default: return false;
+            }
+            if (roots - r0 < 2)
+                return false;
+            --roots;
+            c0[k] = op;
+            s0[k] = s0[roots[-1]];
+            roots[-1] = k++;
+        }
+        code.resize(k);
+        start.resize(k);
+        return roots - r0 == 1;
+    }
+
+    // Collects the subtrees under grain tokens whose parent is not, if
+    // they have at least grain / MIN_TASK_SHARE tokens, in token order:
+    // walks down from the root, left child first
+    void Tree::split(size_t grain, std::vector<Task>& tasks) const {
+        std::vector<uint32_t> todo(1, static_cast<uint32_t>(code.size() - 1));
+        while (!todo.empty()) {
+            const uint32_t k = todo.back();
+            todo.pop_back();
+            const size_t size = k - start[k] + 1;
+            if (size >= grain) {
+                todo.push_back(k - 1);
+                todo.push_back(start[k - 1] - 1);
+            } else if (size >= grain / MIN_TASK_SHARE) {
+                Task task = { start[k], k, 0 };
+                tasks.push_back(task);
+            }
+        }
+    }
+
+    // Runs tokens [first, last], taking the value of each of the sorted
+    // tasks, all within the range, in place of its tokens. The depth never
+    // exceeds half the tokens plus one: the tree was checked.
+    bool runRange(const Tree& tree, size_t first, size_t last, const Task* tasks, size_t taskCount,
+        std::vector<int>& stack, int& result) {
+        stack.resize((last - first) / 2 + 2);
+        const unsigned char* const code = &tree.code[0];
+        int* const s = &stack[0];
+        size_t depth = 0;
+        size_t next = 0;
+        for (size_t k = first; k <= last; ++k) {
+            if (next < taskCount && tasks[next].first == k) {
+                s[depth++] = tasks[next].value;
+                k = tasks[next++].last;
+                continue;
+            }
+            const unsigned char c = code[k];
+            if (c < TOKEN_ADD) {
+                s[depth++] = c;
+                continue;
+            }
+            --depth;
+            bool ok;
+            switch (c) {
+            case TOKEN_ADD: ok = safe_add(s[depth - 1], s[depth], s[depth - 1]); break;
+            case TOKEN_SUB: ok = safe_sub(s[depth - 1], s[depth], s[depth - 1]); break;
+            case TOKEN_MUL: ok = safe_mul(s[depth - 1], s[depth], s[depth - 1]); break;
+            default: ok = safe_div(s[depth - 1], s[depth], s[depth - 1]); break;
+            }
+            if (!ok)
+                return false;
+        }
+        result = s[0];
+        return true;
+    }
+
+    // A worker's share of the tasks, [head, tail): the owner takes from the
+    // head, a worker that ran out steals the back half
+    struct TaskQueue {
+        pthread_mutex_t lock;
+        size_t head;
+        size_t tail;
+    };
+
+    struct TreeJob {
+        const Tree* tree;
+        std::vector<Task>* tasks;
+        std::vector<TaskQueue> queues;
+        int failed;     // set once a task fails; accessed with __sync only
+    };
+
+    struct Worker {
+        TreeJob* job;
+        size_t self;
+    };
+
+    // False once every queue was found empty
+    bool takeTask(TreeJob& job, size_t self, size_t& task) {
+        TaskQueue& own = job.queues[self];
+        pthread_mutex_lock(&own.lock);
+        const bool found = own.head < own.tail;
+        if (found)
+            task = own.head++;
+        pthread_mutex_unlock(&own.lock);
+        if (found)
+            return true;
+        for (size_t i = 1; i < job.queues.size(); ++i) {
+            TaskQueue& victim = job.queues[(self + i) % job.queues.size()];
+            pthread_mutex_lock(&victim.lock);
+            const size_t tail = victim.tail;
+            const size_t mid = victim.head + (tail - victim.head) / 2;
+            if (victim.head < tail)
+                victim.tail = mid;
+            pthread_mutex_unlock(&victim.lock);
+            if (mid < tail) {
+                pthread_mutex_lock(&own.lock);
+                own.head = mid + 1;
+                own.tail = tail;
+                pthread_mutex_unlock(&own.lock);
+                task = mid;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void* treeWorker(void* arg) {
+        Worker& worker = *static_cast<Worker*>(arg);
+        TreeJob& job = *worker.job;
+        std::vector<int> stack;
+        size_t i;
+        while (__sync_add_and_fetch(&job.failed, 0) == 0 && takeTask(job, worker.self, i)) {
+            Task& task = (*job.tasks)[i];
+            if (!runRange(*job.tree, task.first, task.last, NULL, 0, stack, task.value))
+                __sync_lock_test_and_set(&job.failed, 1);
+        }
+        return NULL;
+    }
+
+    // Fills in every task's value, false if one fails. The tasks are dealt
+    // out in even runs; this thread works as well, and any share whose
+    // thread could not be started is stolen by the others.
+    bool runTasks(const Tree& tree, std::vector<Task>& tasks, size_t threads) {
+        TreeJob job;
+        job.tree = &tree;
+        job.tasks = &tasks;
+        job.queues.resize(threads);
+        job.failed = 0;
+        std::vector<Worker> workers(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            pthread_mutex_init(&job.queues[i].lock, NULL);
+            job.queues[i].head = tasks.size() * i / threads;
+            job.queues[i].tail = tasks.size() * (i + 1) / threads;
+            workers[i].job = &job;
+            workers[i].self = i;
+        }
+        std::vector<pthread_t> ids(threads);
+        std::vector<bool> started(threads, false);
+        for (size_t i = 1; i < threads; ++i)
+            started[i] = pthread_create(&ids[i], NULL, treeWorker, &workers[i]) == 0;
+        treeWorker(&workers[0]);
+        for (size_t i = 1; i < threads; ++i) {
+            if (started[i])
+                pthread_join(ids[i], NULL);
+        }
+        for (size_t i = 0; i < threads; ++i)
+            pthread_mutex_destroy(&job.queues[i].lock);
+        return job.failed == 0;
+    }
+}
+
+ParallelEvaluator::ParallelEvaluator(int threads) : _threads(threads < 1 ? 1 : threads) {}
+
+ParallelEvaluator::~ParallelEvaluator() {}
+
+bool ParallelEvaluator::tryEvaluate(const char* expr, size_t len, int& result) const {
+    if (_threads < 2 || len < PARALLEL_MIN_LEN || len / 2 >= MAX_TOKENS)
+        return RPN().tryEvaluate(expr, len, result);
+    Tree tree;
+    if (!tree.build(expr, len))
+        return false;
+    const size_t threads = static_cast<size_t>(_threads);
+    const size_t grain = std::max(MIN_GRAIN, tree.code.size() / (threads * TASKS_PER_THREAD));
+    std::vector<Task> tasks;
+    tree.split(grain, tasks);
+    if (!tasks.empty() && !runTasks(tree, tasks, std::min(threads, tasks.size())))
+        return false;
+    std::vector<int> stack;
+    return runRange(tree, 0, tree.code.size() - 1, tasks.empty() ? NULL : &tasks[0], tasks.size(),
+        stack, result);
+}
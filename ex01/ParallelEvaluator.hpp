@@ -0,0 +1,30 @@
+#ifndef PARALLELEVALUATOR_HPP
+#define PARALLELEVALUATOR_HPP
+
+#include <cstddef>
+
+// Evaluates one very large expression on several threads, with the same
+// outcome as RPN::tryEvaluate: the result, or false for anything RPN
+// rejects.
+// A single pass checks the tokens and records where each token's subtree
+// begins; in postfix a subtree is the run of tokens ending at its root.
+// The biggest subtrees under a grain size are cut off the top of the tree
+// and evaluated concurrently, each worker stealing from the others once
+// its own share runs out. A last sequential pass then runs what is left,
+// taking each subtree's value in place of its tokens.
+// Operations have no side effects, so the expression fails exactly when
+// some operation in it fails, whatever order they are done in.
+class ParallelEvaluator {
+public:
+    explicit ParallelEvaluator(int threads);
+    ~ParallelEvaluator();
+
+    bool tryEvaluate(const char* expr, size_t len, int& result) const;
+private:
+    ParallelEvaluator();
+    ParallelEvaluator(const ParallelEvaluator& other);
+    ParallelEvaluator& operator=(const ParallelEvaluator& other);
+    int _threads;
+};
+
+#endif // PARALLELEVALUATOR_HPP
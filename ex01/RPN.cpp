@@ -1,95 +1,107 @@
 #include "RPN.hpp"
-#include <sstream>
+#include "SafeMath.hpp"
 #include <stdexcept>
-#include <limits>
-#include <cctype>
-#include <climits>
+#include <vector>
 
-RPN::RPN() {}
+// Expressions up to about 1 KiB are evaluated on a stack array
+static const size_t INLINE_DEPTH = 256;
 
-RPN::RPN(const RPN& other) {
-    (void)other;
-}
+RPN::RPN() : _cache(NULL) {}
+
+RPN::RPN(ResultCache* cache) : _cache(cache) {}
+
+RPN::RPN(const RPN& other) : _cache(other._cache) {}
 
 RPN& RPN::operator=(const RPN& other) {
-    (void)other;
+    _cache = other._cache;
     return *this;
 }
 
 RPN::~RPN() {}
 
-static int safe_add(int a, int b);
-static int safe_sub(int a, int b);
-static int safe_mul(int a, int b);
-static int safe_div(int a, int b);
-
 int RPN::evaluate(const std::string& expr) {
-    std::istringstream iss(expr);
-    std::stack<int> stk;
-    std::string token;
-
-    while (iss >> token) {
-        if (token == "+" || token == "-" || token == "*" || token == "/") {
-            if (stk.size() < 2)
-                throw std::runtime_error("Error");
-            int b = stk.top(); stk.pop();
-            int a = stk.top(); stk.pop();
-
-            if (token == "+") stk.push(safe_add(a, b));
-            else if (token == "-") stk.push(safe_sub(a, b));
-            else if (token == "*") stk.push(safe_mul(a, b));
-            else if (token == "/") stk.push(safe_div(a, b));
-
-        } else if (token.size() == 1 && std::isdigit(static_cast<unsigned char>(token[0]))) {
-            stk.push(token[0] - '0');
-        } else {
-            throw std::runtime_error("Error");
-        }
-    }
-
-    if (stk.size() != 1)
+    int result;
+    if (!tryEvaluate(expr.data(), expr.size(), result))
         throw std::runtime_error("Error");
-    return stk.top();
+    return result;
 }
 
-static int safe_add(int a, int b) {
-    const int INT_MAX_V = std::numeric_limits<int>::max();
-    const int INT_MIN_V = std::numeric_limits<int>::min();
-    if (b > 0 && a > INT_MAX_V - b) throw std::runtime_error("Error");
-    if (b < 0 && a < INT_MIN_V - b) throw std::runtime_error("Error");
-    return a + b;
+// The characters std::istream skips between tokens in the "C" locale
+static inline bool isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
-static int safe_sub(int a, int b) {
-    const int INT_MAX_V = std::numeric_limits<int>::max();
-    const int INT_MIN_V = std::numeric_limits<int>::min();
-    if (b > 0 && a < INT_MIN_V + b) throw std::runtime_error("Error");
-    if (b < 0 && a > INT_MAX_V + b) throw std::runtime_error("Error");
-    return a - b;
+// Both results and rejections are cached, keyed by the tokens of expr
+bool RPN::tryEvaluate(const char* expr, size_t len, int& result) const {
+    if (!_cache)
+        return compute(expr, len, result);
+    _key.assign(expr, len);
+    bool ok;
+    if (_cache->find(_key, ok, result))
+        return ok;
+    ok = compute(expr, len, result);
+    _cache->insert(_key, ok, ok ? result : 0);
+    return ok;
 }
 
-static int safe_mul(int a, int b) {
-    const int INT_MAX_V = std::numeric_limits<int>::max();
-    const int INT_MIN_V = std::numeric_limits<int>::min();
-    if (a == 0 || b == 0) return 0;
-    if (a == INT_MIN_V) {
-        if (b == 1) return INT_MIN_V;
-        throw std::runtime_error("Error");
+// Evaluates expr in one pass over its bytes, with no allocation for
+// expressions that fit the inline stack, and false instead of an
+// exception for anything evaluate() would reject.
+// A token is one byte followed by whitespace or the end, dispatched on
+// that byte. Every push beyond the first needs an operator later on, so a
+// valid expression of n tokens never goes deeper than (n + 1) / 2, and n
+// is at most (len + 1) / 2: that bounds the stack, and an expression that
+// would go deeper is rejected there.
+bool RPN::compute(const char* expr, size_t len, int& result) const {
+    int inlineStack[INLINE_DEPTH];
+    std::vector<int> bigStack;
+    const size_t capacity = (len + 3) / 4;
+    int* stack = inlineStack;
+    if (capacity > INLINE_DEPTH) {
+        bigStack.resize(capacity);
+        stack = &bigStack[0];
     }
-    if (b == INT_MIN_V) {
-        if (a == 1) return INT_MIN_V;
-        throw std::runtime_error("Error");
+    const char* p = expr;
+    const char* const end = expr + len;
+    size_t depth = 0;
+    while (p < end) {
+        const char c = *p++;
+        if (isSpace(c))
+            continue;
+        if (p < end && !isSpace(*p))
+            return false;
+        bool ok;
+        switch (c) {
+        case '+':
+            ok = depth >= 2 && safe_add(stack[depth - 2], stack[depth - 1], stack[depth - 2]);
+            --depth;
+            break;
+        case '-':
+            ok = depth >= 2 && safe_sub(stack[depth - 2], stack[depth - 1], stack[depth - 2]);
+            --depth;
+            break;
+        case '*':
+            ok = depth >= 2 && safe_mul(stack[depth - 2], stack[depth - 1], stack[depth - 2]);
+            --depth;
+            break;
+        case '/':
+            ok = depth >= 2 && safe_div(stack[depth - 2], stack[depth - 1], stack[depth - 2]);
+            --depth;
+            break;
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            ok = depth < capacity;
+            if (ok)
+                stack[depth++] = c - '0';
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok)
+            return false;
     }
-
-    int abs_a = a < 0 ? -a : a;
-    int abs_b = b < 0 ? -b : b;
-    if (abs_a > INT_MAX_V / abs_b) throw std::runtime_error("Error");
-    return a * b;
-}
-
-static int safe_div(int a, int b) {
-    const int INT_MIN_V = std::numeric_limits<int>::min();
-    if (b == 0) throw std::runtime_error("Error");
-    if (a == INT_MIN_V && b == -1) throw std::runtime_error("Error");
-    return a / b;
+    if (depth != 1)
+        return false;
+    result = stack[0];
+    return true;
 }
@@ -1,16 +1,26 @@
 #ifndef RPN_HPP
 #define RPN_HPP
 
-#include <stack>
+#include <cstddef>
 #include <string>
+#include "ResultCache.hpp"
 
+// Evaluates one RPN expression of single-digit operands and + - * /.
+// Given a ResultCache, outcomes are looked up there first and recorded
+// after evaluating; the cache may be shared with other threads' RPNs.
 class RPN {
 public:
     RPN();
+    explicit RPN(ResultCache* cache);
     RPN(const RPN& other);
     RPN& operator=(const RPN& other);
     ~RPN();
     int evaluate(const std::string& expr);
+    bool tryEvaluate(const char* expr, size_t len, int& result) const;
+private:
+    bool compute(const char* expr, size_t len, int& result) const;
+    ResultCache* _cache;
+    mutable ResultCache::Key _key;  // reused so lookups do not allocate
 };
 
 #endif // RPN_HPP
@@ -0,0 +1,193 @@
+#include "RPNProgram.hpp"
+#include "SafeMath.hpp"
+#include "LaneMath.hpp"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <cctype>
+
+// Placeholder slots are one byte in the code
+static const size_t MAX_SLOTS = 256;
+// Rows runColumns takes at a time; a multiple of LANE_WIDTH
+static const size_t COLUMN_BLOCK = 256;
+
+RPNProgram::RPNProgram() : _slots(0), _maxDepth(0) {}
+
+// Tokenizes exactly like RPN::evaluate always has: whitespace-separated,
+// each token one operator, one digit or a placeholder
+RPNProgram::RPNProgram(const std::string& expr) : _slots(0), _maxDepth(0) {
+    std::istringstream iss(expr);
+    std::string token;
+    size_t depth = 0;
+
+    while (iss >> token) {
+        if (token == "+" || token == "-" || token == "*" || token == "/") {
+            if (depth < 2)
+                throw std::runtime_error("Error");
+            --depth;
+            emit(token == "+" ? OP_ADD : token == "-" ? OP_SUB : token == "*" ? OP_MUL : OP_DIV);
+        } else if (token.size() == 1 && std::isdigit(static_cast<unsigned char>(token[0]))) {
+            emit(OP_PUSH, static_cast<size_t>(token[0] - '0'));
+            ++depth;
+        } else if (token.size() >= 2 && token.size() <= 4 && token[0] == '$') {
+            size_t slot = 0;
+            for (size_t i = 1; i < token.size(); ++i) {
+                if (!std::isdigit(static_cast<unsigned char>(token[i])))
+                    throw std::runtime_error("Error");
+                slot = slot * 10 + static_cast<size_t>(token[i] - '0');
+            }
+            if (slot >= MAX_SLOTS)
+                throw std::runtime_error("Error");
+            emit(OP_LOAD, slot);
+            if (slot >= _slots)
+                _slots = slot + 1;
+            ++depth;
+        } else {
+            throw std::runtime_error("Error");
+        }
+        if (depth > _maxDepth)
+            _maxDepth = depth;
+    }
+
+    if (depth != 1)
+        throw std::runtime_error("Error");
+    _stack.resize(_maxDepth);
+}
+
+RPNProgram::RPNProgram(const RPNProgram& other)
+    : _code(other._code), _slots(other._slots), _maxDepth(other._maxDepth), _stack(other._stack),
+      _lanes(other._lanes) {}
+
+RPNProgram& RPNProgram::operator=(const RPNProgram& other) {
+    if (this != &other) {
+        _code = other._code;
+        _slots = other._slots;
+        _maxDepth = other._maxDepth;
+        _stack = other._stack;
+        _lanes = other._lanes;
+    }
+    return *this;
+}
+
+RPNProgram::~RPNProgram() {}
+
+void RPNProgram::emit(Op op) {
+    _code.push_back(static_cast<unsigned char>(op));
+}
+
+void RPNProgram::emit(Op op, size_t operand) {
+    _code.push_back(static_cast<unsigned char>(op));
+    _code.push_back(static_cast<unsigned char>(operand));
+}
+
+// Number of values run() needs: one per placeholder up to the highest used
+size_t RPNProgram::slots() const {
+    return _slots;
+}
+
+size_t RPNProgram::maxDepth() const {
+    return _maxDepth;
+}
+
+int RPNProgram::run() {
+    return run(NULL, 0);
+}
+
+// args[i] is the value of $i. The stack never under- or overflows: its
+// depth at every step was checked when compiling.
+int RPNProgram::run(const int* args, size_t count) {
+    if (_code.empty() || count < _slots)
+        throw std::runtime_error("Error");
+    const unsigned char* pc = &_code[0];
+    const unsigned char* const end = pc + _code.size();
+    int* sp = &_stack[0];   // one past the top
+    bool ok = true;
+    while (ok && pc < end) {
+        switch (*pc++) {
+        case OP_PUSH:
+            *sp++ = *pc++;
+            break;
+        case OP_LOAD:
+            *sp++ = args[*pc++];
+            break;
+        case OP_ADD:
+            --sp;
+            ok = safe_add(sp[-1], *sp, sp[-1]);
+            break;
+        case OP_SUB:
+            --sp;
+            ok = safe_sub(sp[-1], *sp, sp[-1]);
+            break;
+        case OP_MUL:
+            --sp;
+            ok = safe_mul(sp[-1], *sp, sp[-1]);
+            break;
+        case OP_DIV:
+            --sp;
+            ok = safe_div(sp[-1], *sp, sp[-1]);
+            break;
+        }
+    }
+    if (!ok)
+        throw std::runtime_error("Error");
+    return _stack[0];
+}
+
+// columns[i][r] is the value of $i in row r. Sets results[r] to the value
+// of row r and errors[r] to 0, or errors[r] to 1 and results[r] to 0 where
+// that row overflows or divides by zero; the other rows are unaffected.
+// Each instruction is applied to a block of rows at once, so decoding is
+// paid per block and the arithmetic runs LANE_WIDTH rows per step.
+// Only a missing column throws.
+void RPNProgram::runColumns(const int* const* columns, size_t count, size_t rows,
+    int* results, unsigned char* errors) {
+    if (_code.empty() || count < _slots)
+        throw std::runtime_error("Error");
+    _lanes.resize((_maxDepth + 1) * COLUMN_BLOCK);
+    int* const err = &_lanes[_maxDepth * COLUMN_BLOCK];
+    const unsigned char* const begin = &_code[0];
+    const unsigned char* const end = begin + _code.size();
+
+    for (size_t first = 0; first < rows; first += COLUMN_BLOCK) {
+        const size_t n = std::min(COLUMN_BLOCK, rows - first);
+        const size_t width = (n + LANE_WIDTH - 1) / LANE_WIDTH * LANE_WIDTH;
+        std::fill(err, err + width, 0);
+        const unsigned char* pc = begin;
+        int* top = &_lanes[0];  // the block one past the top
+        while (pc < end) {
+            switch (*pc++) {
+            case OP_PUSH:
+                std::fill(top, top + width, static_cast<int>(*pc++));
+                top += COLUMN_BLOCK;
+                break;
+            case OP_LOAD: {
+                const int* column = columns[*pc++] + first;
+                std::copy(column, column + n, top);
+                std::fill(top + n, top + width, 1);    // padding lanes, never reported
+                top += COLUMN_BLOCK;
+                break;
+            }
+            case OP_ADD:
+                top -= COLUMN_BLOCK;
+                addLanes(top - COLUMN_BLOCK, top, err, width);
+                break;
+            case OP_SUB:
+                top -= COLUMN_BLOCK;
+                subLanes(top - COLUMN_BLOCK, top, err, width);
+                break;
+            case OP_MUL:
+                top -= COLUMN_BLOCK;
+                mulLanes(top - COLUMN_BLOCK, top, err, width);
+                break;
+            case OP_DIV:
+                top -= COLUMN_BLOCK;
+                divLanes(top - COLUMN_BLOCK, top, err, width);
+                break;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            errors[first + i] = err[i] != 0;
+            results[first + i] = err[i] != 0 ? 0 : _lanes[i];
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef RPNPROGRAM_HPP
+#define RPNPROGRAM_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// An RPN expression compiled once into bytecode and run any number of
+// times. Besides the digits 0-9 and + - * /, an expression may use the
+// placeholders $0, $1, ... ($0 to $255), whose values are bound on each
+// run. Compiling checks the tokens and the stack depth of every step, so
+// running is a dispatch loop over a stack allocated once, and only the
+// arithmetic (overflow, division by zero) or a missing binding can fail.
+// Every failure throws std::runtime_error("Error"), as RPN::evaluate does.
+// runColumns runs the program over whole columns of bindings instead, a
+// block of rows per instruction, and reports failures per row.
+class RPNProgram {
+public:
+    RPNProgram();
+    explicit RPNProgram(const std::string& expr);
+    RPNProgram(const RPNProgram& other);
+    RPNProgram& operator=(const RPNProgram& other);
+    ~RPNProgram();
+
+    size_t slots() const;
+    size_t maxDepth() const;
+    int run();
+    int run(const int* args, size_t count);
+    void runColumns(const int* const* columns, size_t count, size_t rows,
+        int* results, unsigned char* errors);
+private:
+    enum Op {
+        OP_PUSH,    // next byte: digit value
+        OP_LOAD,    // next byte: placeholder slot
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV
+    };
+    void emit(Op op);
+    void emit(Op op, size_t operand);
+    std::vector<unsigned char> _code;
+    size_t _slots;          // highest placeholder used + 1
+    size_t _maxDepth;
+    std::vector<int> _stack;
+    std::vector<int> _lanes;    // runColumns: a block per stack entry, then the error block
+};
+
+#endif // RPNPROGRAM_HPP
@@ -0,0 +1,225 @@
+#include <pthread.h>
+#include "ResultCache.hpp"
+#include "Hash.hpp"
+
+namespace {
+    const size_t SHARD_BITS = 4;
+    const size_t SHARD_COUNT = 1 << SHARD_BITS;
+    const size_t MIN_BUCKETS = 64;
+    const size_t NONE = static_cast<size_t>(-1);
+
+    // The characters std::istream skips between tokens in the "C" locale
+    inline bool isSpace(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+}
+
+struct ResultCache::Entry {
+    uint64_t hash;
+    std::string text;
+    size_t next;        // next entry of the same bucket, or NONE
+    int result;
+    bool ok;
+    bool live;
+    bool referenced;    // hit since the hand last passed
+};
+
+// One lock's worth of the cache: the entries form the clock, and the
+// buckets chain them by hash. Every member is guarded by lock.
+struct ResultCache::Shard {
+    pthread_mutex_t lock;
+    std::vector<Entry> entries;
+    std::vector<size_t> holes;      // entries freed by eviction, reused first
+    std::vector<size_t> buckets;    // chain heads; a power of two
+    size_t hand;
+    size_t live;
+    size_t bytes;
+    size_t maxBytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    explicit Shard(size_t budget)
+        : buckets(MIN_BUCKETS, NONE), hand(0), live(0), bytes(0), maxBytes(budget),
+          hits(0), misses(0), evictions(0) {
+        pthread_mutex_init(&lock, NULL);
+    }
+
+    ~Shard() {
+        pthread_mutex_destroy(&lock);
+    }
+
+    // What an entry is charged against the limit
+    static size_t cost(const std::string& text) {
+        return sizeof(Entry) + text.size();
+    }
+
+    size_t bucketOf(uint64_t hash) const {
+        return static_cast<size_t>(hash) & (buckets.size() - 1);
+    }
+
+    size_t lookup(const Key& key) const {
+        for (size_t i = buckets[bucketOf(key.hash)]; i != NONE; i = entries[i].next) {
+            if (entries[i].hash == key.hash && entries[i].text == key.text)
+                return i;
+        }
+        return NONE;
+    }
+
+    void link(size_t i) {
+        size_t& head = buckets[bucketOf(entries[i].hash)];
+        entries[i].next = head;
+        head = i;
+    }
+
+    void unlink(size_t i) {
+        size_t* p = &buckets[bucketOf(entries[i].hash)];
+        while (*p != i)
+            p = &entries[*p].next;
+        *p = entries[i].next;
+    }
+
+    void grow() {
+        buckets.assign(buckets.size() * 2, NONE);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].live)
+                link(i);
+        }
+    }
+
+    // Frees the first unmarked entry from the hand on; only called with
+    // bytes > 0, so at worst after clearing every mark in one turn
+    void evictOne() {
+        for (;;) {
+            const size_t i = hand;
+            hand = (hand + 1) % entries.size();
+            Entry& e = entries[i];
+            if (!e.live)
+                continue;
+            if (e.referenced) {
+                e.referenced = false;
+                continue;
+            }
+            unlink(i);
+            bytes -= cost(e.text);
+            std::string().swap(e.text);
+            e.live = false;
+            holes.push_back(i);
+            --live;
+            ++evictions;
+            return;
+        }
+    }
+
+    void insert(const Key& key, bool ok, int result) {
+        const size_t size = cost(key.text);
+        if (size > maxBytes || lookup(key) != NONE)
+            return;
+        while (bytes + size > maxBytes)
+            evictOne();
+        size_t i;
+        if (!holes.empty()) {
+            i = holes.back();
+            holes.pop_back();
+        } else {
+            i = entries.size();
+            entries.push_back(Entry());
+        }
+        Entry& e = entries[i];
+        e.hash = key.hash;
+        e.text = key.text;
+        e.result = result;
+        e.ok = ok;
+        e.live = true;
+        e.referenced = false;
+        bytes += size;
+        if (++live > buckets.size())
+            grow();
+        else
+            link(i);
+    }
+};
+
+// Splits on whitespace exactly as RPN does and rejoins the tokens with
+// one space, hashing the text as it is written: one pass, and no
+// allocation once text has grown to the longest expression seen
+void ResultCache::Key::assign(const char* expr, size_t len) {
+    text.resize(len);
+    char* const begin = len ? &text[0] : NULL;
+    char* out = begin;
+    uint64_t h = FNV_OFFSET;
+    bool gap = false;
+    for (size_t i = 0; i < len; ++i) {
+        const char c = expr[i];
+        if (isSpace(c)) {
+            gap = out != begin;
+            continue;
+        }
+        if (gap) {
+            *out++ = ' ';
+            h = (h ^ ' ') * FNV_PRIME;
+            gap = false;
+        }
+        *out++ = c;
+        h = (h ^ static_cast<unsigned char>(c)) * FNV_PRIME;
+    }
+    text.resize(static_cast<size_t>(out - begin));
+    hash = h;
+}
+
+// maxBytes bounds the entries and their texts, split evenly between the
+// shards; bookkeeping outside the entries is not counted
+ResultCache::ResultCache(size_t maxBytes) : _shards(SHARD_COUNT) {
+    for (size_t i = 0; i < SHARD_COUNT; ++i)
+        _shards[i] = new Shard(maxBytes / SHARD_COUNT);
+}
+
+ResultCache::~ResultCache() {
+    for (size_t i = 0; i < _shards.size(); ++i)
+        delete _shards[i];
+}
+
+// The shard comes from the top bits of the hash, the bucket from the low
+// ones. On a hit, ok and (if ok) result are the cached outcome.
+bool ResultCache::find(const Key& key, bool& ok, int& result) {
+    Shard& shard = *_shards[static_cast<size_t>(key.hash >> (64 - SHARD_BITS))];
+    pthread_mutex_lock(&shard.lock);
+    const size_t i = shard.lookup(key);
+    if (i != NONE) {
+        Entry& e = shard.entries[i];
+        e.referenced = true;
+        ok = e.ok;
+        if (ok)
+            result = e.result;
+        ++shard.hits;
+    } else {
+        ++shard.misses;
+    }
+    pthread_mutex_unlock(&shard.lock);
+    return i != NONE;
+}
+
+// Records an outcome, evicting as needed; a key already present (another
+// thread got there first) is left alone
+void ResultCache::insert(const Key& key, bool ok, int result) {
+    Shard& shard = *_shards[static_cast<size_t>(key.hash >> (64 - SHARD_BITS))];
+    pthread_mutex_lock(&shard.lock);
+    shard.insert(key, ok, result);
+    pthread_mutex_unlock(&shard.lock);
+}
+
+// Totals over the shards, each read under its own lock
+ResultCache::Stats ResultCache::stats() const {
+    Stats total = Stats();
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        Shard& shard = *_shards[i];
+        pthread_mutex_lock(&shard.lock);
+        total.hits += shard.hits;
+        total.misses += shard.misses;
+        total.evictions += shard.evictions;
+        total.entries += shard.live;
+        total.bytes += shard.bytes;
+        pthread_mutex_unlock(&shard.lock);
+    }
+    return total;
+}
@@ -0,0 +1,50 @@
+#ifndef RESULTCACHE_HPP
+#define RESULTCACHE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// A bounded cache of expression outcomes, a result or "Error", that any
+// number of threads can share. An expression is keyed by its tokens
+// joined with single spaces, so spacing does not matter, and by the hash
+// of that text; the text is compared as well, so a hash collision never
+// returns another expression's outcome.
+// Entries are spread over shards by hash, each with its own lock and its
+// own share of the byte limit, so there is no lock common to all lookups.
+// A shard evicts with CLOCK: a hit marks the entry, and the sweeping hand
+// spares a marked entry once, clearing its mark.
+class ResultCache {
+public:
+    // An expression's normalized text and its hash, reusable across lookups
+    struct Key {
+        std::string text;
+        uint64_t hash;
+
+        void assign(const char* expr, size_t len);
+    };
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t entries;
+        size_t bytes;
+    };
+
+    explicit ResultCache(size_t maxBytes);
+    ~ResultCache();
+
+    bool find(const Key& key, bool& ok, int& result);
+    void insert(const Key& key, bool ok, int result);
+    Stats stats() const;
+private:
+    struct Entry;
+    struct Shard;
+    ResultCache();
+    ResultCache(const ResultCache& other);
+    ResultCache& operator=(const ResultCache& other);
+    std::vector<Shard*> _shards;
+};
+
+#endif // RESULTCACHE_HPP
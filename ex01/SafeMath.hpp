@@ -0,0 +1,42 @@
+#ifndef SAFEMATH_HPP
+#define SAFEMATH_HPP
+
+#include <climits>
+#include <stdint.h>
+
+// Checked int arithmetic for the RPN evaluators. Each one stores the
+// result and returns true, or returns false (and leaves result alone)
+// where it would overflow or divide by zero.
+// A product is accepted only if its magnitude fits in INT_MAX, so INT_MIN
+// only comes out of INT_MIN * 1 and 1 * INT_MIN.
+
+inline bool safe_add(int a, int b, int& result) {
+    if (b > 0 && a > INT_MAX - b) return false;
+    if (b < 0 && a < INT_MIN - b) return false;
+    result = a + b;
+    return true;
+}
+
+inline bool safe_sub(int a, int b, int& result) {
+    if (b > 0 && a < INT_MIN + b) return false;
+    if (b < 0 && a > INT_MAX + b) return false;
+    result = a - b;
+    return true;
+}
+
+inline bool safe_mul(int a, int b, int& result) {
+    const int64_t product = static_cast<int64_t>(a) * b;
+    if ((product > INT_MAX || product < -INT_MAX) && !(product == INT_MIN && (a == 1 || b == 1)))
+        return false;
+    result = static_cast<int>(product);
+    return true;
+}
+
+inline bool safe_div(int a, int b, int& result) {
+    if (b == 0) return false;
+    if (a == INT_MIN && b == -1) return false;
+    result = a / b;
+    return true;
+}
+
+#endif // SAFEMATH_HPP
@@ -1,7 +1,130 @@
 #include "RPN.hpp"
+#include "BatchEvaluator.hpp"
+#include "OutputBuffer.hpp"
+#include "ResultCache.hpp"
+#include "ParallelEvaluator.hpp"
 #include <iostream>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A whole decimal number in [min, max]
+static bool parseCount(const char* text, long min, long max, long& value) {
+    char* end;
+    value = std::strtol(text, &end, 10);
+    return *text != '\0' && *end == '\0' && value >= min && value <= max;
+}
+
+// ./RPN --batch [-j threads] [--cache bytes] [file]: one expression per
+// line of the file, or of stdin without one
+static int batch(int argc, char* argv[]) {
+    long threads = 1;
+    long cacheBytes = 0;
+    int argi = 2;
+    for (; argi + 1 < argc; argi += 2) {
+        bool ok;
+        if (std::strcmp(argv[argi], "-j") == 0)
+            ok = parseCount(argv[argi + 1], 1, 256, threads);
+        else if (std::strcmp(argv[argi], "--cache") == 0)
+            ok = parseCount(argv[argi + 1], 1, LONG_MAX, cacheBytes);
+        else
+            break;
+        if (!ok) {
+            std::cerr << "Error" << std::endl;
+            return 1;
+        }
+    }
+    if (argc - argi > 1) {
+        std::cerr << "Error" << std::endl;
+        return 1;
+    }
+    int in = STDIN_FILENO;
+    if (argi < argc && std::strcmp(argv[argi], "-") != 0 && (in = open(argv[argi], O_RDONLY)) < 0) {
+        std::cerr << "Error" << std::endl;
+        return 1;
+    }
+    bool ok;
+    {
+        // Results and errors are buffered; tied when they share a target so
+        // the lines stay interleaved
+        OutputBuffer out(STDOUT_FILENO, 1 << 20);
+        OutputBuffer err(STDERR_FILENO, 1 << 16);
+        if (OutputBuffer::sameTarget(STDOUT_FILENO, STDERR_FILENO)) {
+            out.tie(&err);
+            err.tie(&out);
+        }
+        ResultCache cache(static_cast<size_t>(cacheBytes));
+        BatchEvaluator evaluator(static_cast<int>(threads));
+        if (cacheBytes > 0)
+            evaluator.setCache(&cache);
+        ok = evaluator.run(in, out, err);
+    }
+    if (in != STDIN_FILENO)
+        close(in);
+    if (!ok) {
+        std::cerr << "Error" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Appends everything left in fd to data
+static bool readAll(int fd, std::vector<char>& data) {
+    const size_t block = 1 << 20;
+    for (;;) {
+        const size_t old = data.size();
+        data.resize(old + block);
+        ssize_t n;
+        do {
+            n = read(fd, &data[old], block);
+        } while (n < 0 && errno == EINTR);
+        data.resize(old + (n > 0 ? static_cast<size_t>(n) : 0));
+        if (n <= 0)
+            return n == 0;
+    }
+}
+
+// ./RPN --parallel [-j threads] [file]: the whole file, or stdin without
+// one, is a single expression; by default one thread per processor
+static int parallel(int argc, char* argv[]) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int argi = 2;
+    if (argi + 1 < argc && std::strcmp(argv[argi], "-j") == 0) {
+        if (!parseCount(argv[argi + 1], 1, 256, threads)) {
+            std::cerr << "Error" << std::endl;
+            return 1;
+        }
+        argi += 2;
+    }
+    int in = STDIN_FILENO;
+    if (argc - argi > 1
+        || (argi < argc && std::strcmp(argv[argi], "-") != 0 && (in = open(argv[argi], O_RDONLY)) < 0)) {
+        std::cerr << "Error" << std::endl;
+        return 1;
+    }
+    std::vector<char> expr;
+    const bool read = readAll(in, expr);
+    if (in != STDIN_FILENO)
+        close(in);
+    ParallelEvaluator evaluator(static_cast<int>(threads));
+    int result;
+    if (!read || !evaluator.tryEvaluate(expr.empty() ? "" : &expr[0], expr.size(), result)) {
+        std::cerr << "Error" << std::endl;
+        return 1;
+    }
+    std::cout << result << std::endl;
+    return 0;
+}
 
 int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::strcmp(argv[1], "--batch") == 0)
+        return batch(argc, argv);
+    if (argc >= 2 && std::strcmp(argv[1], "--parallel") == 0)
+        return parallel(argc, argv);
     if (argc != 2) {
         std::cerr << "Error" << std::endl;
         return 1;